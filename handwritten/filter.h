@@ -0,0 +1,278 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <atomic>
+#include <cstdio>
+#include <tuple>
+#include <assert.h>
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "pipeline.h"
+
+/*
+ * Adaptive conjunctive filters
+ *
+ * An AdaptiveFilter evaluates a conjunction of row predicates a batch of
+ * FILTER_BATCH_ROWS rows at a time, one predicate after the other, each
+ * narrowing a selection vector of the rows still passing. The first batch of
+ * every run() is a sample: all predicates are evaluated on all of its rows,
+ * which measures each predicate's cost and selectivity. The predicates are
+ * then ordered by rank, cost / (1 - selectivity), so that cheap predicates
+ * which reject many rows go first.
+ *
+ * A step narrows the selection either with a branch
+ * (if (p(i)) sel[n++] = i) or without one (sel[n] = i; n += p(i)). The branch
+ * is cheaper while it is predictable, but mispredicts on up to half of the
+ * rows as the selectivity approaches 50%. Each step therefore tracks its
+ * running selectivity, given the steps before it, and branches only while
+ * that is within FILTER_BRANCH_MARGIN of 0 or 1.
+ */
+#define FILTER_BATCH_ROWS PIPELINE_BATCH_ROWS
+#define FILTER_MAX_PREDICATES 8
+#define FILTER_BRANCH_MARGIN 0.1
+
+/** Counts the decisions of an AdaptiveFilter, across threads and runs, for
+ * the benchmark output.
+ */
+struct FilterStats {
+  int num_predicates;
+  const char* const* names;
+
+  std::atomic<long> rows;
+  std::atomic<long> passed;
+  std::atomic<long> branching_steps;
+  std::atomic<long> branch_free_steps;
+
+  // Per predicate, over the sampled batches.
+  std::atomic<long> samples;
+  std::atomic<long> sampled_rows;
+  std::atomic<long> sample_passed[FILTER_MAX_PREDICATES];
+  std::atomic<long> sample_cycles[FILTER_MAX_PREDICATES];
+  // How often each predicate was ordered first.
+  std::atomic<long> first[FILTER_MAX_PREDICATES];
+
+  FilterStats(const char* const* names, int num_predicates) :
+    num_predicates(num_predicates), names(names), rows(0), passed(0),
+    branching_steps(0), branch_free_steps(0), samples(0), sampled_rows(0) {
+    assert(num_predicates <= FILTER_MAX_PREDICATES);
+    for (int p = 0; p < FILTER_MAX_PREDICATES; p++) {
+      sample_passed[p] = 0;
+      sample_cycles[p] = 0;
+      first[p] = 0;
+    }
+  }
+
+  void print(const char* label) const {
+    long steps = branching_steps + branch_free_steps;
+    long n = sampled_rows > 0 ? sampled_rows.load() : 1;
+    printf("%s adaptive filter: %ld rows, %.3f%% passed, %ld samples, %.1f%% of steps branching\n",
+        label, rows.load(), 100.0 * passed / (rows > 0 ? rows.load() : 1), samples.load(),
+        100.0 * branching_steps / (steps > 0 ? steps : 1));
+    for (int p = 0; p < num_predicates; p++) {
+      printf("  %-36s selectivity %5.1f%%, %5.2f cycles/row, first in %ld samples\n",
+          names[p], 100.0 * sample_passed[p] / n, (double) sample_cycles[p] / n,
+          first[p].load());
+    }
+  }
+};
+
+/** Narrows the selection in to the rows passing pred, into out, and returns
+ * their number. in == NULL selects the rows [base, base + n). out may be in.
+ */
+struct FilterRefine {
+  bool branching;
+  int base;
+  const int* in;
+  int n;
+  int* out;
+
+  template <typename Pred>
+  int operator()(const Pred& pred) const {
+    int m = 0;
+    if (in == NULL) {
+      if (branching) {
+        for (int k = 0; k < n; k++) {
+          if (pred(base + k)) {
+            out[m++] = base + k;
+          }
+        }
+      } else {
+        for (int k = 0; k < n; k++) {
+          out[m] = base + k;
+          m += pred(base + k);
+        }
+      }
+    } else {
+      if (branching) {
+        for (int k = 0; k < n; k++) {
+          if (pred(in[k])) {
+            out[m++] = in[k];
+          }
+        }
+      } else {
+        for (int k = 0; k < n; k++) {
+          out[m] = in[k];
+          m += pred(in[k]);
+        }
+      }
+    }
+    return m;
+  }
+};
+
+/** Evaluates pred on the rows [base, base + n) into pass, and returns the
+ * number passing.
+ */
+struct FilterTest {
+  int base;
+  int n;
+  uint8_t* pass;
+
+  template <typename Pred>
+  int operator()(const Pred& pred) const {
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+      pass[k] = pred(base + k);
+      m += pass[k];
+    }
+    return m;
+  }
+};
+
+/** Applies op to the p-th predicate of a tuple, for a p known only at run
+ * time.
+ */
+template <size_t I>
+struct FilterDispatch {
+  template <typename Tuple, typename Op>
+  static inline int apply(const Tuple& preds, int p, const Op& op) {
+    return p == (int) I ? op(std::get<I>(preds)) : FilterDispatch<I - 1>::apply(preds, p, op);
+  }
+};
+
+template <>
+struct FilterDispatch<0> {
+  template <typename Tuple, typename Op>
+  static inline int apply(const Tuple& preds, int, const Op& op) {
+    return op(std::get<0>(preds));
+  }
+};
+
+/** A conjunction of predicates, each a functor bool(int row). Build one with
+ * make_filter. run() may be called by many threads at once.
+ */
+template <typename... Preds>
+struct AdaptiveFilter {
+  static const int num_predicates = sizeof...(Preds);
+
+  FilterStats* stats;
+  std::tuple<Preds...> preds;
+
+  AdaptiveFilter(FilterStats* stats, Preds... preds) : stats(stats), preds(preds...) {
+    assert(stats->num_predicates == num_predicates);
+  }
+
+  /** Filters the rows [start, end), calling f(sel, n) with the n rows sel of
+   * each batch that pass all predicates.
+   */
+  template <typename F>
+  void run(int start, int end, F f) const {
+    if (start >= end) {
+      return;
+    }
+    int sel[FILTER_BATCH_ROWS];
+    uint8_t pass[num_predicates][FILTER_BATCH_ROWS];
+    int order[num_predicates];
+    // Rows into and out of each step, so far.
+    long in_rows[num_predicates];
+    long out_rows[num_predicates];
+    double rank[num_predicates];
+    long steps = 0;
+    long branching = 0;
+    long passed = 0;
+
+    // Sample the first batch.
+    int n = end - start < FILTER_BATCH_ROWS ? end - start : FILTER_BATCH_ROWS;
+    for (int p = 0; p < num_predicates; p++) {
+      FilterTest test = {start, n, pass[p]};
+      uint64_t before = __rdtsc();
+      int m = FilterDispatch<num_predicates - 1>::apply(preds, p, test);
+      uint64_t cycles = __rdtsc() - before;
+
+      stats->sample_passed[p] += m;
+      stats->sample_cycles[p] += cycles;
+      double selectivity = (double) m / n;
+      rank[p] = selectivity < 1.0 ? (cycles + 1) / (1.0 - selectivity) : 1e30;
+
+      // Insertion sort by rank.
+      int j = p;
+      for (; j > 0 && rank[order[j - 1]] > rank[p]; j--) {
+        order[j] = order[j - 1];
+      }
+      order[j] = p;
+    }
+    stats->samples++;
+    stats->sampled_rows += n;
+    stats->first[order[0]]++;
+
+    // The selectivity of each step, given the ones before it.
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+      sel[m] = start + k;
+      m += pass[order[0]][k];
+    }
+    in_rows[0] = n;
+    out_rows[0] = m;
+    for (int s = 1; s < num_predicates; s++) {
+      const uint8_t* step_pass = pass[order[s]];
+      in_rows[s] = m;
+      int m_out = 0;
+      for (int k = 0; k < m; k++) {
+        sel[m_out] = sel[k];
+        m_out += step_pass[sel[k] - start];
+      }
+      out_rows[s] = m_out;
+      m = m_out;
+    }
+    if (m > 0) {
+      f((const int*) sel, m);
+      passed += m;
+    }
+
+    for (int base = start + n; base < end; base += FILTER_BATCH_ROWS) {
+      m = end - base < FILTER_BATCH_ROWS ? end - base : FILTER_BATCH_ROWS;
+      const int* in = NULL;
+      for (int s = 0; s < num_predicates && m > 0; s++) {
+        double selectivity = in_rows[s] ? (double) out_rows[s] / in_rows[s] : 0.0;
+        bool branch = selectivity < FILTER_BRANCH_MARGIN ||
+          selectivity > 1.0 - FILTER_BRANCH_MARGIN;
+        steps++;
+        branching += branch;
+
+        FilterRefine refine = {branch, base, in, m, sel};
+        int m_out = FilterDispatch<num_predicates - 1>::apply(preds, order[s], refine);
+        in_rows[s] += m;
+        out_rows[s] += m_out;
+        m = m_out;
+        in = sel;
+      }
+      if (m > 0) {
+        f((const int*) sel, m);
+        passed += m;
+      }
+    }
+
+    stats->rows += end - start;
+    stats->passed += passed;
+    stats->branching_steps += branching;
+    stats->branch_free_steps += steps - branching;
+  }
+};
+
+template <typename... Preds>
+AdaptiveFilter<Preds...> make_filter(FilterStats* stats, Preds... preds) {
+  return AdaptiveFilter<Preds...>(stats, preds...);
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef KEY_INDEX_H
+#define KEY_INDEX_H
+
+#include <stdio.h>
+
+#include "utils.h"
+
+/** The key range of a dimension table's primary keys, for joins that
+ * address the table's columns, or a bitmap over them, by key.
+ *
+ * The TPC-H generators emit dense keys in order (the row of partkey k is
+ * k - 1), which the constructor detects. The row of a key is then a
+ * subtraction; otherwise a consumer maps the keys itself.
+ */
+struct KeyIndex {
+  int rows;
+  // Whether keys[i] == min_key + i for every row.
+  bool dense;
+  int min_key;
+  int max_key;
+
+  KeyIndex(const int* keys, int rows) : rows(rows), dense(true), min_key(0), max_key(-1) {
+    if (rows == 0) {
+      return;
+    }
+    struct KeyRange {
+      int min;
+      int max;
+      bool dense;
+    };
+    KeyRange init = {keys[0], keys[0], true};
+    KeyRange range = morsel_reduce(rows, init,
+        [&](KeyRange& r, int start, int end) {
+          for (int i = start; i < end; i++) {
+            r.dense &= keys[i] == keys[0] + i;
+            r.min = keys[i] < r.min ? keys[i] : r.min;
+            r.max = keys[i] > r.max ? keys[i] : r.max;
+          }
+        },
+        [](KeyRange& r, const KeyRange& s) {
+          r.dense &= s.dense;
+          r.min = s.min < r.min ? s.min : r.min;
+          r.max = s.max > r.max ? s.max : r.max;
+        });
+    dense = range.dense;
+    min_key = range.min;
+    max_key = range.max;
+  }
+
+  void print(const char* name) const {
+    printf("%s index: %d keys in [%d, %d], %s\n", name, rows, min_key, max_key,
+        dense ? "dense" : "sparse");
+  }
+};
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "utils.h"
+#include "bitmap.h"
+
+/*
+ * Vectorized execution
+ *
+ * pipeline_scan hands the rows of a scan to a pipeline PIPELINE_BATCH_ROWS
+ * at a time, as a Selection. The select operators narrow the selection with
+ * a predicate, evaluated on whole columns so that the compiler turns the
+ * compares into SIMD ones, and the aggregates consume it.
+ *
+ * A Selection holds the rows still qualifying either as a byte mask over the
+ * batch or as a vector of row ids. While many rows qualify, the mask is kept
+ * and the aggregates use masked arithmetic over the whole batch. Once fewer
+ * than PIPELINE_COMPACT_BELOW of the rows qualify, the mask is compacted into
+ * row ids with SIMD compress instructions, and the later operators only
+ * touch the qualifying rows. Operators that look values up per row, like
+ * for_each, always compact first.
+ *
+ * A batch's row ids, mask and the batch of a few columns all stay in the L1
+ * data cache (32 KB): 1024 rows are 5 KB of selection plus 1-4 KB per column.
+ */
+#define PIPELINE_BATCH_ROWS 1024
+#define PIPELINE_COMPACT_BELOW 0.25
+
+typedef enum {
+  SELECT_ALL = 0, // every row of the batch
+  SELECT_MASK,    // the rows whose mask byte is 1
+  SELECT_IDS,     // the n rows in ids
+} SelectionMode;
+
+typedef int (*compact_kernel)(const uint8_t* mask, int base, int rows, int* ids);
+
+/** Writes the rows base + k whose mask[k] is 1 to ids, in order. ids must
+ * have room for rows + 16 ids.
+ *
+ * @return the number of rows written
+ */
+inline int compact_mask_scalar(const uint8_t* mask, int base, int rows, int* ids) {
+  int n = 0;
+  for (int k = 0; k < rows; k++) {
+    ids[n] = base + k;
+    n += mask[k];
+  }
+  return n;
+}
+
+// Uses PEXT to turn 8 mask bytes into the byte offsets of the selected
+// lanes, which permute 8 row ids in one step.
+__attribute__((target("avx2,bmi2,popcnt")))
+inline int compact_mask_avx2(const uint8_t* mask, int base, int rows, int* ids) {
+  const __m256i v_step = _mm256_set1_epi32(8);
+  __m256i v_ids = _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  int n = 0;
+  int k = 0;
+  for (; k + 8 <= rows; k += 8) {
+    uint64_t bytes;
+    memcpy(&bytes, mask + k, 8);
+    uint64_t lanes = _pext_u64(0x0706050403020100ULL, bytes * 0xFF);
+    __m256i v_perm = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(lanes));
+    _mm256_storeu_si256((__m256i*) (ids + n), _mm256_permutevar8x32_epi32(v_ids, v_perm));
+    n += _mm_popcnt_u64(bytes);
+    v_ids = _mm256_add_epi32(v_ids, v_step);
+  }
+  return n + compact_mask_scalar(mask + k, base + k, rows - k, ids + n);
+}
+
+TARGET_AVX512
+inline int compact_mask_avx512(const uint8_t* mask, int base, int rows, int* ids) {
+  const __m512i v_step = _mm512_set1_epi32(16);
+  __m512i v_ids = _mm512_add_epi32(_mm512_set1_epi32(base),
+      _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+  int n = 0;
+  int k = 0;
+  for (; k + 16 <= rows; k += 16) {
+    __m512i v_mask = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (mask + k)));
+    __mmask16 m = _mm512_test_epi32_mask(v_mask, v_mask);
+    _mm512_mask_compressstoreu_epi32(ids + n, m, v_ids);
+    n += __builtin_popcount(m);
+    v_ids = _mm512_add_epi32(v_ids, v_step);
+  }
+  return n + compact_mask_scalar(mask + k, base + k, rows - k, ids + n);
+}
+
+/** Returns the widest compaction kernel the CPU supports. */
+inline compact_kernel compact_kernel_for(SimdLevel level) {
+  if (level >= SIMD_AVX512) {
+    return compact_mask_avx512;
+  }
+  if (level >= SIMD_AVX2 && __builtin_cpu_supports("bmi2")) {
+    return compact_mask_avx2;
+  }
+  return compact_mask_scalar;
+}
+
+inline int compact_mask(const uint8_t* mask, int base, int rows, int* ids) {
+  static const compact_kernel kernel = compact_kernel_for(detect_simd_level());
+  return kernel(mask, base, rows, ids);
+}
+
+/** The rows of a batch [base, base + rows) that still qualify. */
+struct Selection {
+  int base;
+  int rows;
+  // Rows selected.
+  int n;
+  SelectionMode mode;
+  uint8_t mask[PIPELINE_BATCH_ROWS];
+  int ids[PIPELINE_BATCH_ROWS + 16];
+
+  void reset(int batch_base, int batch_rows) {
+    base = batch_base;
+    rows = batch_rows;
+    n = batch_rows;
+    mode = SELECT_ALL;
+  }
+
+  /** Keeps the rows i for which pred(i) holds. */
+  template <typename Pred>
+  void select(Pred pred) {
+    if (n == 0) {
+      return;
+    }
+    int m = 0;
+    if (mode == SELECT_IDS) {
+      for (int k = 0; k < n; k++) {
+        ids[m] = ids[k];
+        m += pred(ids[k]);
+      }
+      n = m;
+      return;
+    }
+    if (mode == SELECT_ALL) {
+      for (int k = 0; k < rows; k++) {
+        mask[k] = pred(base + k);
+        m += mask[k];
+      }
+    } else {
+      for (int k = 0; k < rows; k++) {
+        mask[k] &= pred(base + k);
+        m += mask[k];
+      }
+    }
+    masked(m);
+  }
+
+  /** Keeps the rows i whose bit keys[i] - offset is set in bitmap, probing
+   * with vector gathers: of the keys of the whole batch while the selection
+   * is a mask, and of the keys of the selected rows once it is row ids.
+   */
+  void select_bitmap(const Bitmap& bitmap, const int* keys, int offset) {
+    if (n == 0) {
+      return;
+    }
+    if (mode == SELECT_IDS) {
+      n = bitmap.select(keys, offset, ids, n);
+      return;
+    }
+    if (mode == SELECT_ALL) {
+      memset(mask, 1, rows);
+    }
+    bitmap.probe(keys + base, offset, rows, mask);
+    int m = 0;
+    for (int k = 0; k < rows; k++) {
+      m += mask[k];
+    }
+    masked(m);
+  }
+
+  /** Keeps the rows with lo <= column < hi. Both bounds must fit T, so the
+   * compares stay as narrow as the column.
+   */
+  template <typename T>
+  void select_range(const T* column, int lo, int hi) {
+    const T t_lo = (T) lo;
+    const T t_hi = (T) hi;
+    select([=](int i) { return (column[i] >= t_lo) & (column[i] < t_hi); });
+  }
+
+  /** Keeps the rows with a < b. */
+  template <typename T>
+  void select_less(const T* a, const T* b) {
+    select([=](int i) { return a[i] < b[i]; });
+  }
+
+  /** Turns the selection into row ids. */
+  void compact() {
+    if (mode == SELECT_ALL) {
+      for (int k = 0; k < rows; k++) {
+        ids[k] = base + k;
+      }
+    } else if (mode == SELECT_MASK) {
+      n = compact_mask(mask, base, rows, ids);
+    }
+    mode = SELECT_IDS;
+  }
+
+  /** Returns the sum of value(i) over the selected rows i. */
+  template <typename V>
+  decimal_sum_t sum(V value) const {
+    decimal_sum_t result = 0;
+    if (mode == SELECT_ALL) {
+      for (int k = 0; k < rows; k++) {
+        result += value(base + k);
+      }
+    } else if (mode == SELECT_MASK) {
+      for (int k = 0; k < rows; k++) {
+        result += mask[k] * value(base + k);
+      }
+    } else {
+      for (int k = 0; k < n; k++) {
+        result += value(ids[k]);
+      }
+    }
+    return result;
+  }
+
+  /** Calls f(i) for each selected row i, in order. */
+  template <typename F>
+  void for_each(F f) {
+    if (n == 0) {
+      return;
+    }
+    compact();
+    for (int k = 0; k < n; k++) {
+      f(ids[k]);
+    }
+  }
+
+ private:
+  // Switches to the mask, now selecting m rows, or compacts it if m is
+  // below the threshold.
+  void masked(int m) {
+    n = m;
+    mode = SELECT_MASK;
+    if (n < rows * PIPELINE_COMPACT_BELOW) {
+      compact();
+    }
+  }
+};
+
+/** Runs pipeline(selection) on each batch of the rows [start, end). */
+template <typename Pipeline>
+void pipeline_scan(int start, int end, Pipeline pipeline) {
+  Selection selection;
+  for (int base = start; base < end; base += PIPELINE_BATCH_ROWS) {
+    selection.reset(base, end - base < PIPELINE_BATCH_ROWS ? end - base : PIPELINE_BATCH_ROWS);
+    pipeline(selection);
+  }
+}
+
+#endif
@@ -32,222 +32,418 @@ ORDER BY
 #include <omp.h>
 #include <sys/time.h>
 #include <string.h>
+#include <immintrin.h>
 
 #include "utils.h"
-
-#define NUM_PARALLEL_THREADS   48
+#include "scan.h"
 
 using namespace std;
 
 // Number of rows in the lineitem table
-size_t num_lineitems;
+int num_lineitems;
 
 // Scale factor
 int SF;
 
-struct Q1Entry {
-  int sum_qty;
-  double sum_base_price;
-  double sum_disc_price;
-  double sum_charge;
-  double sum_discount;
-  int count;  // The average values can be computed from the fields here
-};
+// l_shipdate <= date '1998-12-01' - interval '90' day
+constexpr date_t SHIPDATE_CUTOFF = date_add_days(make_date(1998, 12, 1), -90);
 
-struct PackedLineitem {
-  int returnflag;
-  int linestatus;
-  int quantity;
-  int shipdate;
-  double extendedprice;
-  double discount;
-  double tax;
+// All sums are exact. See the fixed-point decimal scales in utils.h.
+struct Q1Entry {
+  int64_t sum_qty;
+  decimal_sum_t sum_base_price;     // Scaled by 10^2.
+  decimal_sum_t sum_disc_price;     // Scaled by 10^4.
+  wide_decimal_sum_t sum_charge;    // Scaled by 10^6.
+  decimal_sum_t sum_discount;       // Scaled by 10^2.
+  int64_t count;  // The average values can be computed from the fields here
 };
 
 struct Buckets {
   struct Q1Entry entries[3][2];
 };
 
-void q1_worker(Lineitem *lineitems, Buckets *b, int tid) {
-
-  memset(b, 0, sizeof(Buckets));
-
-  size_t start = (num_lineitems / NUM_PARALLEL_THREADS) * tid;
-  size_t end = start + (num_lineitems / NUM_PARALLEL_THREADS);
-  if (end > num_lineitems) {
-    end = num_lineitems;
-  }
+// Each row's group is returnflag * 2 + linestatus.
+#define Q1_GROUPS 6
+
+// The query as a template scan, on any table with the Q1 columns. The
+// aggregates are the fields of Q1Entry, in order.
+template <typename Table>
+using Q1Scan = GroupedScan<
+    CompositeKey<COLUMN(Table, returnflag), COLUMN(Table, linestatus), 2>, Q1_GROUPS,
+    Range<COLUMN(Table, shipdate), 0, SHIPDATE_CUTOFF + 1>,
+    Sum<COLUMN(Table, quantity)>,
+    Sum<COLUMN(Table, extendedprice)>,
+    SumProduct<COLUMN(Table, extendedprice), OneMinus<COLUMN(Table, discount)> >,
+    Sum<Product<Wide<Product<COLUMN(Table, extendedprice), OneMinus<COLUMN(Table, discount)> > >,
+                OnePlus<COLUMN(Table, tax)> >, wide_decimal_sum_t>,
+    Sum<COLUMN(Table, discount)>,
+    Count>;
+
+// Rows unpacked at a time from the bit-packed columns.
+#define UNPACK_BATCH 1024
+
+// The Q1 columns, with the byte-wide low-cardinality ones bit-packed.
+struct BitPackedLineitem {
+  BitPackedColumn returnflag;  // 2 bits
+  BitPackedColumn linestatus;  // 1 bit
+  BitPackedColumn quantity;    // 6 bits
+  date_t *shipdate;
+  decimal_t *extendedprice;
+  small_decimal_t *discount;
+  small_decimal_t *tax;
+
+  BitPackedLineitem(Lineitem *l, size_t n) :
+    returnflag(l->returnflag, n, 2),
+    linestatus(l->linestatus, n, 1),
+    quantity(l->quantity, n, 6),
+    shipdate(l->shipdate),
+    extendedprice(l->extendedprice),
+    discount(l->discount),
+    tax(l->tax) {}
+};
 
-  if (tid == NUM_PARALLEL_THREADS - 1) {
-    end = num_lineitems;
+void print_result(Buckets *final) {
+  printf("sum_qty | sum_base_price | sum_disc_price | sum_charge | "
+      "avg_qty | avg_price | avg_disc | count_order\n");
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 2; j++) {
+      Q1Entry &e = final->entries[i][j];
+      if (e.count != 0) {
+        printf("%ld | %s | %s | %s | %s | %s | %s | %ld\n",
+            (long)e.sum_qty,
+            format_decimal(e.sum_base_price, 2).c_str(),
+            format_decimal(e.sum_disc_price, 4).c_str(),
+            format_decimal(e.sum_charge, 6).c_str(),
+            format_decimal(e.sum_qty, 0, 2, e.count).c_str(),
+            format_decimal(e.sum_base_price, 2, 2, e.count).c_str(),
+            format_decimal(e.sum_discount, 2, 2, e.count).c_str(),
+            (long)e.count);
+      }
+    }
   }
+}
 
-  for (size_t i = start; i < end; i++) {
-    if (lineitems->shipdate[i] <= 19981201 - 90) {
-      struct Q1Entry *entry = &b->entries[lineitems->returnflag[i]][lineitems->linestatus[i]];
-      entry->sum_qty += lineitems->quantity[i];
-      entry->sum_base_price += lineitems->extendedprice[i];
-      entry->sum_disc_price += lineitems->extendedprice[i] * (1 - lineitems->discount[i]);
-      entry->sum_charge += lineitems->extendedprice[i] * (1 - lineitems->discount[i]) * (1 + lineitems->tax[i]);
-      entry->sum_discount += lineitems->discount[i];
-      entry->count++;
+// Adds the aggregates of b into into.
+void merge_buckets(Buckets &into, const Buckets &b) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 2; j++) {
+      into.entries[i][j].sum_qty += b.entries[i][j].sum_qty;
+      into.entries[i][j].sum_base_price += b.entries[i][j].sum_base_price;
+      into.entries[i][j].sum_disc_price += b.entries[i][j].sum_disc_price;
+      into.entries[i][j].sum_charge += b.entries[i][j].sum_charge;
+      into.entries[i][j].sum_discount += b.entries[i][j].sum_discount;
+      into.entries[i][j].count += b.entries[i][j].count;
     }
   }
 }
 
-void q1_worker_packed(PackedLineitem *lineitems, Buckets *b, int tid) {
+// Adds the groups of a Q1Scan state into b.
+template <typename State>
+void add_groups(Buckets *b, const State &state) {
+  for (int g = 0; g < Q1_GROUPS; g++) {
+    struct Q1Entry *entry = &b->entries[g >> 1][g & 1];
+    entry->sum_qty += std::get<0>(state.groups[g]);
+    entry->sum_base_price += std::get<1>(state.groups[g]);
+    entry->sum_disc_price += std::get<2>(state.groups[g]);
+    entry->sum_charge += std::get<3>(state.groups[g]);
+    entry->sum_discount += std::get<4>(state.groups[g]);
+    entry->count += std::get<5>(state.groups[g]);
+  }
+}
 
-  memset(b, 0, sizeof(Buckets));
+// Aggregates the rows [start, end) into b, one row at a time.
+template <typename Table>
+void q1_rows(Table *lineitems, Buckets *b, int start, int end) {
+  typename Q1Scan<Table>::State state = typename Q1Scan<Table>::State();
+  Q1Scan<Table>::run(*lineitems, start, end, state);
+  add_groups(b, state);
+}
 
-  size_t start = (num_lineitems / NUM_PARALLEL_THREADS) * tid;
-  size_t end = start + (num_lineitems / NUM_PARALLEL_THREADS);
-  if (end > num_lineitems) {
-    end = num_lineitems;
+/*
+ * SIMD kernels.
+ *
+ * The kernels below aggregate the rows [start, end) columnar, a vector of
+ * rows at a time, and return the index of the first row they did not
+ * process (the rest is handled by q1_rows). Each row's group is
+ * returnflag * 2 + linestatus, and each of the 6 groups has its own vector
+ * accumulators: a row is added to the accumulators of its group under the
+ * mask (shipdate passes) & (group id matches), so there is no scatter and
+ * no branch per row. The 64-bit sums are reduced into b once per call, which
+ * holds at most a morsel of rows, so none of the lanes can overflow.
+ */
+
+#ifdef __AVX2__
+template <typename Table>
+int q1_kernel_avx2(Table *l, Buckets *b, int start, int end) {
+  const __m256i v_cutoff = _mm256_set1_epi32(SHIPDATE_CUTOFF + 1);
+  const __m256i v_scale = _mm256_set1_epi32(DECIMAL_SCALE);
+
+  // 32-bit lanes.
+  __m256i sum_qty[Q1_GROUPS], sum_discount[Q1_GROUPS];
+  // 64-bit lanes.
+  __m256i sum_base_price[Q1_GROUPS], sum_disc_price[Q1_GROUPS], sum_charge[Q1_GROUPS];
+  int64_t count[Q1_GROUPS];
+  for (int g = 0; g < Q1_GROUPS; g++) {
+    sum_qty[g] = sum_discount[g] = _mm256_setzero_si256();
+    sum_base_price[g] = sum_disc_price[g] = sum_charge[g] = _mm256_setzero_si256();
+    count[g] = 0;
   }
 
-  if (tid == NUM_PARALLEL_THREADS - 1) {
-    end = num_lineitems;
+  int i;
+  for (i = start; i + 8 <= end; i += 8) {
+    __m256i shipdate = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(l->shipdate + i)));
+    __m256i pass = _mm256_cmpgt_epi32(v_cutoff, shipdate);
+
+    __m256i returnflag = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l->returnflag + i)));
+    __m256i linestatus = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l->linestatus + i)));
+    __m256i group = _mm256_add_epi32(_mm256_slli_epi32(returnflag, 1), linestatus);
+
+    __m256i quantity = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l->quantity + i)));
+    __m256i discount = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l->discount + i)));
+    __m256i tax = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l->tax + i)));
+    __m256i price = _mm256_loadu_si256((const __m256i *)(l->extendedprice + i));
+
+    // price * (100 - discount) fits 32 bits; times (100 + tax) it does not.
+    __m256i disc_price = _mm256_mullo_epi32(price, _mm256_sub_epi32(v_scale, discount));
+    __m256i tax_factor = _mm256_add_epi32(v_scale, tax);
+
+    __m256i price_lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(price));
+    __m256i price_hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(price, 1));
+    __m256i disc_price_lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(disc_price));
+    __m256i disc_price_hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(disc_price, 1));
+    __m256i charge_lo = _mm256_mul_epu32(disc_price_lo,
+        _mm256_cvtepu32_epi64(_mm256_castsi256_si128(tax_factor)));
+    __m256i charge_hi = _mm256_mul_epu32(disc_price_hi,
+        _mm256_cvtepu32_epi64(_mm256_extracti128_si256(tax_factor, 1)));
+
+    // The group ids of the failing rows are set to Q1_GROUPS, so they match
+    // no group. Widening them once saves widening each group's mask.
+    group = _mm256_blendv_epi8(_mm256_set1_epi32(Q1_GROUPS), group, pass);
+    __m256i group_lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(group));
+    __m256i group_hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(group, 1));
+
+    for (int g = 0; g < Q1_GROUPS; g++) {
+      __m256i m = _mm256_cmpeq_epi32(group, _mm256_set1_epi32(g));
+      __m256i m_lo = _mm256_cmpeq_epi64(group_lo, _mm256_set1_epi64x(g));
+      __m256i m_hi = _mm256_cmpeq_epi64(group_hi, _mm256_set1_epi64x(g));
+
+      count[g] += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+      sum_qty[g] = _mm256_add_epi32(sum_qty[g], _mm256_and_si256(m, quantity));
+      sum_discount[g] = _mm256_add_epi32(sum_discount[g], _mm256_and_si256(m, discount));
+      sum_base_price[g] = _mm256_add_epi64(sum_base_price[g], _mm256_and_si256(m_lo, price_lo));
+      sum_base_price[g] = _mm256_add_epi64(sum_base_price[g], _mm256_and_si256(m_hi, price_hi));
+      sum_disc_price[g] = _mm256_add_epi64(sum_disc_price[g], _mm256_and_si256(m_lo, disc_price_lo));
+      sum_disc_price[g] = _mm256_add_epi64(sum_disc_price[g], _mm256_and_si256(m_hi, disc_price_hi));
+      sum_charge[g] = _mm256_add_epi64(sum_charge[g], _mm256_and_si256(m_lo, charge_lo));
+      sum_charge[g] = _mm256_add_epi64(sum_charge[g], _mm256_and_si256(m_hi, charge_hi));
+    }
   }
 
-  for (size_t i = start; i < end; i++) {
-    if (lineitems[i].shipdate <= 19981201 - 90) {
-      struct Q1Entry *entry = &b->entries[lineitems[i].returnflag][lineitems[i].linestatus];
-      entry->sum_qty += lineitems[i].quantity;
-      entry->sum_base_price += lineitems[i].extendedprice;
-      entry->sum_disc_price += lineitems[i].extendedprice * (1 - lineitems[i].discount);
-      entry->sum_charge += lineitems[i].extendedprice * (1 - lineitems[i].discount) * (1 + lineitems[i].tax);
-      entry->sum_discount += lineitems[i].discount;
-      entry->count++;
+  for (int g = 0; g < Q1_GROUPS; g++) {
+    int32_t qty[8], disc[8];
+    int64_t base_price[4], disc_price[4], charge[4];
+    _mm256_storeu_si256((__m256i *) qty, sum_qty[g]);
+    _mm256_storeu_si256((__m256i *) disc, sum_discount[g]);
+    _mm256_storeu_si256((__m256i *) base_price, sum_base_price[g]);
+    _mm256_storeu_si256((__m256i *) disc_price, sum_disc_price[g]);
+    _mm256_storeu_si256((__m256i *) charge, sum_charge[g]);
+
+    struct Q1Entry *entry = &b->entries[g >> 1][g & 1];
+    for (int k = 0; k < 8; k++) {
+      entry->sum_qty += qty[k];
+      entry->sum_discount += disc[k];
     }
+    for (int k = 0; k < 4; k++) {
+      entry->sum_base_price += base_price[k];
+      entry->sum_disc_price += disc_price[k];
+      entry->sum_charge += charge[k];
+    }
+    entry->count += count[g];
   }
+  return i;
 }
+#endif
+
+#ifdef __AVX512F__
+template <typename Table>
+int q1_kernel_avx512(Table *l, Buckets *b, int start, int end) {
+  const __m512i v_cutoff = _mm512_set1_epi32(SHIPDATE_CUTOFF);
+  const __m512i v_scale = _mm512_set1_epi32(DECIMAL_SCALE);
+
+  // 32-bit lanes.
+  __m512i sum_qty[Q1_GROUPS], sum_discount[Q1_GROUPS];
+  // 64-bit lanes.
+  __m512i sum_base_price[Q1_GROUPS], sum_disc_price[Q1_GROUPS], sum_charge[Q1_GROUPS];
+  int64_t count[Q1_GROUPS];
+  for (int g = 0; g < Q1_GROUPS; g++) {
+    sum_qty[g] = sum_discount[g] = _mm512_setzero_si512();
+    sum_base_price[g] = sum_disc_price[g] = sum_charge[g] = _mm512_setzero_si512();
+    count[g] = 0;
+  }
 
-void run_query(Lineitem *lineitems) {
-  struct timeval before, after, diff;
-
-  Buckets final;
-  memset(&final, 0, sizeof(final));
-
-  gettimeofday(&before, 0);
-
-#pragma omp parallel for
-  for (int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-
-
-    Buckets b;
-    q1_worker(lineitems, &b, i);
-
-#pragma omp critical(merge)
-    {
-    for (int i = 0; i < 3; i++) {
-      for (int j = 0; j < 2; j++) {
-        final.entries[i][j].sum_qty += b.entries[i][j].sum_qty;
-        final.entries[i][j].sum_base_price += b.entries[i][j].sum_base_price;
-        final.entries[i][j].sum_disc_price += b.entries[i][j].sum_disc_price;
-        final.entries[i][j].sum_charge += b.entries[i][j].sum_charge;
-        final.entries[i][j].sum_discount += b.entries[i][j].sum_discount;
-        final.entries[i][j].count += b.entries[i][j].count;
-      }
-    }
+  int i;
+  for (i = start; i + 16 <= end; i += 16) {
+    __m512i shipdate = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(l->shipdate + i)));
+    __mmask16 pass = _mm512_cmple_epu32_mask(shipdate, v_cutoff);
+
+    __m512i returnflag = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(l->returnflag + i)));
+    __m512i linestatus = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(l->linestatus + i)));
+    __m512i group = _mm512_add_epi32(_mm512_slli_epi32(returnflag, 1), linestatus);
+
+    __m512i quantity = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(l->quantity + i)));
+    __m512i discount = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(l->discount + i)));
+    __m512i tax = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(l->tax + i)));
+    __m512i price = _mm512_loadu_si512((const void *)(l->extendedprice + i));
+
+    // price * (100 - discount) fits 32 bits; times (100 + tax) it does not.
+    __m512i disc_price = _mm512_mullo_epi32(price, _mm512_sub_epi32(v_scale, discount));
+    __m512i tax_factor = _mm512_add_epi32(v_scale, tax);
+
+    __m512i price_lo = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(price));
+    __m512i price_hi = _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(price, 1));
+    __m512i disc_price_lo = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(disc_price));
+    __m512i disc_price_hi = _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(disc_price, 1));
+    __m512i charge_lo = _mm512_mul_epu32(disc_price_lo,
+        _mm512_cvtepu32_epi64(_mm512_castsi512_si256(tax_factor)));
+    __m512i charge_hi = _mm512_mul_epu32(disc_price_hi,
+        _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(tax_factor, 1)));
+
+    for (int g = 0; g < Q1_GROUPS; g++) {
+      __mmask16 m = _mm512_mask_cmpeq_epi32_mask(pass, group, _mm512_set1_epi32(g));
+      __mmask8 m_lo = (__mmask8) m;
+      __mmask8 m_hi = (__mmask8) (m >> 8);
+
+      count[g] += __builtin_popcount(m);
+      sum_qty[g] = _mm512_mask_add_epi32(sum_qty[g], m, sum_qty[g], quantity);
+      sum_discount[g] = _mm512_mask_add_epi32(sum_discount[g], m, sum_discount[g], discount);
+      sum_base_price[g] = _mm512_mask_add_epi64(sum_base_price[g], m_lo, sum_base_price[g], price_lo);
+      sum_base_price[g] = _mm512_mask_add_epi64(sum_base_price[g], m_hi, sum_base_price[g], price_hi);
+      sum_disc_price[g] = _mm512_mask_add_epi64(sum_disc_price[g], m_lo, sum_disc_price[g], disc_price_lo);
+      sum_disc_price[g] = _mm512_mask_add_epi64(sum_disc_price[g], m_hi, sum_disc_price[g], disc_price_hi);
+      sum_charge[g] = _mm512_mask_add_epi64(sum_charge[g], m_lo, sum_charge[g], charge_lo);
+      sum_charge[g] = _mm512_mask_add_epi64(sum_charge[g], m_hi, sum_charge[g], charge_hi);
     }
+  }
 
+  for (int g = 0; g < Q1_GROUPS; g++) {
+    struct Q1Entry *entry = &b->entries[g >> 1][g & 1];
+    entry->sum_qty += _mm512_reduce_add_epi32(sum_qty[g]);
+    entry->sum_discount += _mm512_reduce_add_epi32(sum_discount[g]);
+    entry->sum_base_price += _mm512_reduce_add_epi64(sum_base_price[g]);
+    entry->sum_disc_price += _mm512_reduce_add_epi64(sum_disc_price[g]);
+    entry->sum_charge += _mm512_reduce_add_epi64(sum_charge[g]);
+    entry->count += count[g];
   }
+  return i;
+}
+#endif
+
+// Aggregates the rows [start, end) whose shipdate zones may pass into b,
+// with kernel(lineitems, b, run_start, run_end) followed by q1_rows for the
+// rows the kernel leaves. Works on either the orderkey-sorted Lineitem or
+// its shipdate-sorted projection, where the rows past the cutoff are whole
+// zones at the end.
+template <typename Table, typename Kernel>
+void q1_scan(Table *lineitems, Buckets *b, int start, int end, Kernel kernel) {
+  lineitems->shipdate_zones.scan(start, end, 0, SHIPDATE_CUTOFF + 1,
+      [&](int run_start, int run_end) {
+    int i = kernel(lineitems, b, run_start, run_end);
+    q1_rows(lineitems, b, i, run_end);
+  });
+}
 
-  gettimeofday(&after, 0);
-  timersub(&after, &before, &diff);
+template <typename Table>
+void q1_worker(Table *lineitems, Buckets *b, int start, int end) {
+  q1_scan(lineitems, b, start, end, [](Table *, Buckets *, int run_start, int) {
+    return run_start;
+  });
+}
 
-  printf("sum_qty | sum_base_price | sum_disc_price | sum_charge | "
-      "avg_qty | avg_price | avg_disc | count_order\n");
-  for (int i = 0; i < 3; i++) {
-    for (int j = 0; j < 2; j++) {
-      if (final.entries[i][j].count != 0.0) {
-        printf("%d | %f | %f |%f | %d | %f |%f | %d\n",
-            final.entries[i][j].sum_qty,
-            final.entries[i][j].sum_base_price,
-            final.entries[i][j].sum_disc_price,
-            final.entries[i][j].sum_charge,
-            final.entries[i][j].sum_qty / final.entries[i][j].count,
-            final.entries[i][j].sum_base_price / final.entries[i][j].count,
-            final.entries[i][j].sum_discount / final.entries[i][j].count,
-            final.entries[i][j].count);
-      }
-    }
-  }
+#ifdef __AVX2__
+template <typename Table>
+void q1_worker_avx2(Table *lineitems, Buckets *b, int start, int end) {
+  q1_scan(lineitems, b, start, end, q1_kernel_avx2<Table>);
+}
+#endif
 
-  printf("Q1 Complete: %ld.%06ld\n", (long)diff.tv_sec, (long)diff.tv_usec);
+#ifdef __AVX512F__
+template <typename Table>
+void q1_worker_avx512(Table *lineitems, Buckets *b, int start, int end) {
+  q1_scan(lineitems, b, start, end, q1_kernel_avx512<Table>);
 }
+#endif
+
+// A batch of BitPackedLineitem rows, with the packed columns unpacked, as a
+// table for Q1Scan.
+struct UnpackedBatch {
+  date_t *shipdate;
+  decimal_t *extendedprice;
+  small_decimal_t *discount;
+  small_decimal_t *tax;
+  uint8_t *returnflag;
+  uint8_t *linestatus;
+  uint8_t *quantity;
+};
 
-void run_query_packed(PackedLineitem *lineitems) {
+void q1_worker_bitpacked(BitPackedLineitem *lineitems, Buckets *b, int start, int end) {
+  uint8_t returnflag[UNPACK_BATCH];
+  uint8_t linestatus[UNPACK_BATCH];
+  uint8_t quantity[UNPACK_BATCH];
+
+  Q1Scan<UnpackedBatch>::State state = Q1Scan<UnpackedBatch>::State();
+  for (int batch = start; batch < end; batch += UNPACK_BATCH) {
+    int n = end - batch < UNPACK_BATCH ? end - batch : UNPACK_BATCH;
+    lineitems->returnflag.unpack(batch, n, returnflag);
+    lineitems->linestatus.unpack(batch, n, linestatus);
+    lineitems->quantity.unpack(batch, n, quantity);
+
+    UnpackedBatch rows = {
+      lineitems->shipdate + batch,
+      lineitems->extendedprice + batch,
+      lineitems->discount + batch,
+      lineitems->tax + batch,
+      returnflag,
+      linestatus,
+      quantity,
+    };
+    Q1Scan<UnpackedBatch>::run(rows, 0, n, state);
+  }
+  add_groups(b, state);
+}
+
+// Runs worker(lineitems, buckets, start, end) over the morsels of the table
+// and prints the merged result, the time taken and the scan bandwidth.
+template <typename Table, typename Worker>
+void run_query(Table *lineitems, Worker worker, const char *name, double bytes_per_row) {
   struct timeval before, after, diff;
 
-  Buckets final;
-  memset(&final, 0, sizeof(final));
+  Buckets empty;
+  memset(&empty, 0, sizeof(empty));
 
   gettimeofday(&before, 0);
 
-#pragma omp parallel for
-  for (int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-
-    struct timeval before, after, diff;
-    gettimeofday(&before, 0);
-
-    Buckets b;
-    q1_worker_packed(lineitems, &b, i);
-
-#pragma omp critical(merge)
-    {
-    for (int i = 0; i < 3; i++) {
-      for (int j = 0; j < 2; j++) {
-        final.entries[i][j].sum_qty += b.entries[i][j].sum_qty;
-        final.entries[i][j].sum_base_price += b.entries[i][j].sum_base_price;
-        final.entries[i][j].sum_disc_price += b.entries[i][j].sum_disc_price;
-        final.entries[i][j].sum_charge += b.entries[i][j].sum_charge;
-        final.entries[i][j].sum_discount += b.entries[i][j].sum_discount;
-        final.entries[i][j].count += b.entries[i][j].count;
-      }
-    }
-    }
-
-    gettimeofday(&after, 0);
-    timersub(&after, &before, &diff);
-    printf("%d - %ld.%06ld\n", i, (long)diff.tv_sec, (long)diff.tv_usec);
-
-  }
+  Buckets final = morsel_reduce(num_lineitems, empty,
+      [&](Buckets &b, int start, int end) {
+        worker(lineitems, &b, start, end);
+      }, merge_buckets);
 
   gettimeofday(&after, 0);
   timersub(&after, &before, &diff);
 
-  printf("sum_qty | sum_base_price | sum_disc_price | sum_charge | "
-      "avg_qty | avg_price | avg_disc | count_order\n");
-  for (int i = 0; i < 3; i++) {
-    for (int j = 0; j < 2; j++) {
-      if (final.entries[i][j].count != 0.0) {
-        printf("%d | %f | %f |%f | %d | %f |%f | %d\n",
-            final.entries[i][j].sum_qty,
-            final.entries[i][j].sum_base_price,
-            final.entries[i][j].sum_disc_price,
-            final.entries[i][j].sum_charge,
-            final.entries[i][j].sum_qty / final.entries[i][j].count,
-            final.entries[i][j].sum_base_price / final.entries[i][j].count,
-            final.entries[i][j].sum_discount / final.entries[i][j].count,
-            final.entries[i][j].count);
-      }
-    }
-  }
+  print_result(&final);
 
-  printf("Q1 Complete: %ld.%06ld\n", (long)diff.tv_sec, (long)diff.tv_usec);
+  double seconds = diff.tv_sec + diff.tv_usec / 1e6;
+  printf("%s Complete: %ld.%06ld (%.2f GB/s)\n", name, (long)diff.tv_sec, (long)diff.tv_usec,
+      seconds > 0 ? num_lineitems * bytes_per_row / seconds / 1e9 : 0.0);
 }
 
 void loadData_q1(string data_dir, Lineitem *lineitems) {
-  string fpath = data_dir + "/lineitem.tbl";
-  FILE *lineitem_tbl = fopen(fpath.c_str(), "r");
-  num_lineitems = load_lineitems(lineitems, lineitem_tbl, 0);
-  fclose(lineitem_tbl);
+  num_lineitems = load_lineitem_table(lineitems, data_dir, SF);
 }
 
 int main(int argc, char **argv) {
   if(!load_sf(argc, argv, SF)) {
-    printf("Run as ./q1 -sf <SF>\n");
+    printf("Run as ./q1 -sf <SF> [-nosnapshot]\n");
     return 0;
   }
   string data_dir = "../tpch/sf" + std::to_string(SF);
@@ -257,26 +453,38 @@ int main(int argc, char **argv) {
   loadData_q1(data_dir, lineitems);
   printf("Done loading data ... \n");
 
-  int returnflag;
-  int linestatus;
-  int quantity;
-  double extendedprice;
-  double discount;
-  double tax;
-
-  PackedLineitem *lineitems_packed = (PackedLineitem *)malloc(sizeof(PackedLineitem) * 6002000 * SF);
-  for (int i = 0; i < num_lineitems; i++) {
-    lineitems_packed[i].returnflag = lineitems->returnflag[i];
-    lineitems_packed[i].linestatus = lineitems->linestatus[i];
-    lineitems_packed[i].quantity = lineitems->quantity[i];
-    lineitems_packed[i].extendedprice = lineitems->extendedprice[i];
-    lineitems_packed[i].discount = lineitems->discount[i];
-    lineitems_packed[i].tax = lineitems->tax[i];
-  }
+  // Bytes of the Q1 columns read per row.
+  double columnar_bytes = sizeof(*lineitems->shipdate) + sizeof(*lineitems->extendedprice) +
+    sizeof(*lineitems->discount) + sizeof(*lineitems->tax) +
+    sizeof(*lineitems->quantity) + sizeof(*lineitems->returnflag) +
+    sizeof(*lineitems->linestatus);
+  double bitpacked_bytes = sizeof(*lineitems->shipdate) + sizeof(*lineitems->extendedprice) +
+    sizeof(*lineitems->discount) + sizeof(*lineitems->tax) + (2 + 1 + 6) / 8.0;
+  printf("Bytes per row: columnar %.0f, bit-packed %.2f\n", columnar_bytes, bitpacked_bytes);
+
+  run_query(lineitems, q1_worker<Lineitem>, "Q1 Scalar", columnar_bytes);
+#ifdef __AVX2__
+  run_query(lineitems, q1_worker_avx2<Lineitem>, "Q1 AVX2", columnar_bytes);
+#endif
+#ifdef __AVX512F__
+  run_query(lineitems, q1_worker_avx512<Lineitem>, "Q1 AVX-512", columnar_bytes);
+#endif
+
+  build_shipdate_projection(lineitems, num_lineitems);
+#if defined(__AVX512F__)
+  run_query(lineitems->by_shipdate, q1_worker_avx512<LineitemByShipdate>,
+      "Q1 Sorted By Shipdate", columnar_bytes);
+#elif defined(__AVX2__)
+  run_query(lineitems->by_shipdate, q1_worker_avx2<LineitemByShipdate>,
+      "Q1 Sorted By Shipdate", columnar_bytes);
+#else
+  run_query(lineitems->by_shipdate, q1_worker<LineitemByShipdate>,
+      "Q1 Sorted By Shipdate", columnar_bytes);
+#endif
+
+  BitPackedLineitem bitpacked(lineitems, num_lineitems);
+  run_query(&bitpacked, q1_worker_bitpacked, "Q1 Bit-Packed", bitpacked_bytes);
 
   delete lineitems;
-
-  //run_query(lineitems);
-  run_query_packed(lineitems_packed);
   return 0;
 }
@@ -44,10 +44,10 @@ where rownum <= -1;
 #include <iostream>
 
 #include "utils.h"
+#include "filter.h"
+#include "pipeline.h"
 using namespace std;
 
-#define NUM_PARALLEL_THREADS 24
-
 // Global variables.
 // Number of rows in the lineitems table.
 int num_lineitems;
@@ -55,91 +55,95 @@ int num_lineitems;
 // Scale factor.
 int SF;
 
-void partition_withsync(
-    Order* o,
-    Lineitem* l,
-    int partition,
-    int results[2][2]) {
+// l_receiptdate >= date '1994-01-01'
+// and l_receiptdate < date '1994-01-01' + interval '1' year
+constexpr date_t RECEIPTDATE_LOW = make_date(1994, 1, 1);
+constexpr date_t RECEIPTDATE_HIGH = date_add_years(RECEIPTDATE_LOW, 1);
 
-  struct timeval before, after, diff;
-  gettimeofday(&before, 0);
-
-  int local_results[2][2] = {{0}};
+// l_shipmode in ('MAIL', 'AIR'): the loader codes MAIL as 1 and AIR as 2
+// (see shipmode_decoder), counted at counts[shipmode - 1].
+#define SHIPMODE_MAIL 1
+#define SHIPMODE_AIR 2
+static const char* SHIPMODE_NAMES[] = { "MAIL", "AIR" };
 
-  int start = (partition * num_lineitems) / NUM_PARALLEL_THREADS;
-  int end = ((partition + 1) * num_lineitems) / NUM_PARALLEL_THREADS;
-  for (int i=start; i<end; i++) {
-    if (l->commitdate[i] >= l->recieptdate[i] ||
-        !(l->recieptdate[i] >= 19940101 and l->recieptdate[i] < 19950101) ||
-        l->shipdate[i] >= l->commitdate[i]) {
-      continue;
-    }
+// Line counts per shipmode, for high and low order priorities.
+struct Q12Counts {
+  int counts[2][2];
+};
 
-    int shipmode = l->shipmode[i];
-    if (shipmode == 0 || shipmode == 1) {
-      int orderpriority = o->orderpriority[l->orderindex[i]];
-      if (orderpriority == 1 || orderpriority == 2) {
-        local_results[shipmode][0] += 1;
-      } else {
-        local_results[shipmode][1] += 1;
-      }
+void merge_counts(Q12Counts& into, const Q12Counts& c) {
+  for (int j=0; j<2; j++) {
+    for (int k=0; k<2; k++) {
+      into.counts[j][k] += c.counts[j][k];
     }
   }
-#pragma omp critical(merge)
-  {
-    results[0][0] += local_results[0][0];
-    results[0][1] += local_results[0][1];
-    results[1][0] += local_results[1][0];
-    results[1][1] += local_results[1][1];
-  }
+}
 
-  gettimeofday(&after, 0);
-  timersub(&after, &before, &diff);
-  printf("Parititon %d -  %ld.%06ld\n", partition, (long) diff.tv_sec, (long) diff.tv_usec);
+// Counts the rows [start, end), looking up their orders via orderindex.
+void partition_withsync(
+    Order* o,
+    Lineitem* l,
+    int start,
+    int end,
+    Q12Counts& results) {
+  l->recieptdate_zones.scan(start, end, RECEIPTDATE_LOW, RECEIPTDATE_HIGH,
+      [&](int run_start, int run_end) {
+    pipeline_scan(run_start, run_end, [&](Selection& s) {
+      s.select_range(l->recieptdate, RECEIPTDATE_LOW, RECEIPTDATE_HIGH);
+      s.select_less(l->commitdate, l->recieptdate);
+      s.select_less(l->shipdate, l->commitdate);
+      s.select_range(l->shipmode, SHIPMODE_MAIL, SHIPMODE_AIR + 1);
+      s.for_each([&](int i) {
+        int orderpriority = o->orderpriority[l->orderindex[i]];
+        results.counts[l->shipmode[i] - 1][orderpriority == 1 || orderpriority == 2 ? 0 : 1]++;
+      });
+    });
+  });
 }
 
+// Counts the rows [start, end) row at a time, finding their orders through
+// the join index.
 void partition_nosync(
     Order* o,
     Lineitem* l,
-    int partition,
-    int results[2][2]) {
-  int start = (partition * num_lineitems) / NUM_PARALLEL_THREADS;
-	int end = ((partition + 1) * num_lineitems) / NUM_PARALLEL_THREADS;
-  int order_index = binary_search(o->orderkey, ORDERS_PER_SF * SF, l->orderkey[start]);
-  for (int i=start; i<end; i++) {
-    if (l->commitdate[i] >= l->recieptdate[i]) continue;
-    if (!(l->recieptdate[i] >= 19940101 and l->recieptdate[i] < 19950101)) continue;
-    if (l->shipdate[i] >= l->commitdate[i]) continue;
-
-    int shipmode = l->shipmode[i];
-    if (shipmode == 0 || shipmode == 1) {
-      int orderkey = l->orderkey[i];
-      while (o->orderkey[order_index] != orderkey) order_index++;
-      int orderpriority = o->orderpriority[order_index];
-      if (orderpriority == 1 || orderpriority == 2) {
-        results[shipmode][0] += 1;
-      } else {
-        results[shipmode][1] += 1;
+    int start,
+    int end,
+    Q12Counts& results) {
+  l->recieptdate_zones.scan(start, end, RECEIPTDATE_LOW, RECEIPTDATE_HIGH,
+      [&](int run_start, int run_end) {
+    for (int i=run_start; i<run_end; i++) {
+      if (l->commitdate[i] >= l->recieptdate[i]) continue;
+      if (!(l->recieptdate[i] >= RECEIPTDATE_LOW and l->recieptdate[i] < RECEIPTDATE_HIGH)) continue;
+      if (l->shipdate[i] >= l->commitdate[i]) continue;
+
+      int shipmode = l->shipmode[i];
+      if (shipmode == SHIPMODE_MAIL || shipmode == SHIPMODE_AIR) {
+        int orderpriority = o->orderpriority[l->orderindex[i]];
+        if (orderpriority == 1 || orderpriority == 2) {
+          results.counts[shipmode - 1][0] += 1;
+        } else {
+          results.counts[shipmode - 1][1] += 1;
+        }
       }
     }
-  }
+  });
 }
 
 
 void with_sync(Order* orders, Lineitem* lineitems) {
   struct timeval before, after, diff;
   gettimeofday(&before, 0);
-	int result[2][2] = {{0}};
+  Q12Counts empty = {{{0}}};
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    partition_withsync(orders, lineitems, i, result);
-  }
+  Q12Counts result = morsel_reduce(num_lineitems, empty,
+      [&](Q12Counts& counts, int start, int end) {
+        partition_withsync(orders, lineitems, start, end, counts);
+      }, merge_counts);
   gettimeofday(&after, 0);
   timersub(&after, &before, &diff);
 
   for (int j=0; j<2; j++) {
-    printf("%d: %d | %d\n", j, result[j][0], result[j][1]);
+    printf("%s: %d | %d\n", SHIPMODE_NAMES[j], result.counts[j][0], result.counts[j][1]);
   }
   printf("Q12 withsync: %ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
 }
@@ -148,45 +152,68 @@ void with_sync(Order* orders, Lineitem* lineitems) {
 void without_sync(Order* orders, Lineitem* lineitems) {
   struct timeval before, after, diff;
   gettimeofday(&before, 0);
-	int partitioned_results[4][2][2] = {{{0}}};
+  Q12Counts empty = {{{0}}};
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    partition_nosync(orders, lineitems, i, partitioned_results[i]);
-  }
+  Q12Counts result = morsel_reduce(num_lineitems, empty,
+      [&](Q12Counts& counts, int start, int end) {
+        partition_nosync(orders, lineitems, start, end, counts);
+      }, merge_counts);
 
-  int result[2][2] = {{0}};
-  for (int i=0; i<4; i++) {
-    for (int j=0; j<2; j++) {
-      for (int k=0; k<2; k++) {
-        result[j][k] += partitioned_results[i][j][k];
-      }
-    }
+  gettimeofday(&after, 0);
+  timersub(&after, &before, &diff);
+  for (int j=0; j<2; j++) {
+    printf("%s: %d | %d\n", SHIPMODE_NAMES[j], result.counts[j][0], result.counts[j][1]);
   }
+  printf("Q12 withoutsync: %ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
+}
+
+// The Q12 conjuncts on lineitem, for the adaptive filter.
+static const char* Q12_PREDICATES[] = {
+  "l_shipmode in ('MAIL', 'AIR')",
+  "l_commitdate < l_receiptdate",
+  "l_shipdate < l_commitdate",
+  "l_receiptdate >= date '1994-01-01'",
+  "l_receiptdate < date '1995-01-01'",
+};
+
+// Counts the rows passing filter, looking up their orders via orderindex.
+template <typename Filter>
+void adaptive(Order* orders, Lineitem* lineitems, const Filter& filter) {
+  struct timeval before, after, diff;
+  gettimeofday(&before, 0);
+  Q12Counts empty = {{{0}}};
+
+  Q12Counts result = morsel_reduce(num_lineitems, empty,
+      [&](Q12Counts& counts, int start, int end) {
+        lineitems->recieptdate_zones.scan(start, end, RECEIPTDATE_LOW, RECEIPTDATE_HIGH,
+            [&](int run_start, int run_end) {
+          filter.run(run_start, run_end, [&](const int* sel, int n) {
+            for (int k = 0; k < n; k++) {
+              int i = sel[k];
+              int orderpriority = orders->orderpriority[lineitems->orderindex[i]];
+              counts.counts[lineitems->shipmode[i] - 1][orderpriority == 1 || orderpriority == 2 ? 0 : 1]++;
+            }
+          });
+        });
+      }, merge_counts);
 
   gettimeofday(&after, 0);
   timersub(&after, &before, &diff);
   for (int j=0; j<2; j++) {
-    printf("%d: %d | %d\n", j, result[j][0], result[j][1]);
+    printf("%s: %d | %d\n", SHIPMODE_NAMES[j], result.counts[j][0], result.counts[j][1]);
   }
-  printf("Q12 withoutsync: %ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
+  printf("Q12 adaptive: %ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
 }
 
 void load_data_q12(string data_dir, Order* orders, Lineitem* lineitems) {
-  string fpath = data_dir + "/orders.tbl";
-  FILE* order_tbl = fopen(fpath.c_str(), "r");
-  load_orders(orders, order_tbl, 0, 1, SF);
-  fclose(order_tbl);
-
-  fpath = data_dir + "/lineitem.tbl";
-  FILE* lineitem_tbl = fopen(fpath.c_str(), "r");
-  num_lineitems = load_lineitems(lineitems, lineitem_tbl, 0);
-  fclose(lineitem_tbl);
+  int num_orders = load_order_table(orders, data_dir, SF);
+  num_lineitems = load_lineitem_table(lineitems, data_dir, SF);
+  build_order_join_indexes(lineitems, num_lineitems, orders, num_orders, data_dir, SF);
 }
 
 int main(int argc, char** argv) {
   if (!load_sf(argc, argv, SF)) {
-    printf("Run as ./q12 -sf <SF>\n");
+    printf("Run as ./q12 -sf <SF> [-nosnapshot]\n");
     return 0;
   }
 
@@ -195,18 +222,29 @@ int main(int argc, char** argv) {
   Lineitem* lineitems = new Lineitem(6002000 * SF);
   load_data_q12(data_dir, orders, lineitems);
 
-  int order_index = 0;
-  for (int i = 0; i < num_lineitems; i++) {
-    int orderkey = lineitems->orderkey[i];
-    while (orders->orderkey[order_index] != orderkey) order_index++;
-    lineitems->orderindex[i] = order_index;
-  }
+  printf("Receiptdate zones scanned: %d of %d\n",
+      lineitems->recieptdate_zones.matching(RECEIPTDATE_LOW, RECEIPTDATE_HIGH),
+      lineitems->recieptdate_zones.num_zones);
 
   for (int i = 0; i < 5; i++) {
      with_sync(orders, lineitems);
   }
   //without_sync(orders, lineitems);
 
+  FilterStats stats(Q12_PREDICATES, 5);
+  auto filter = make_filter(&stats,
+      [=](int i) {
+        return lineitems->shipmode[i] == SHIPMODE_MAIL || lineitems->shipmode[i] == SHIPMODE_AIR;
+      },
+      [=](int i) { return lineitems->commitdate[i] < lineitems->recieptdate[i]; },
+      [=](int i) { return lineitems->shipdate[i] < lineitems->commitdate[i]; },
+      [=](int i) { return lineitems->recieptdate[i] >= RECEIPTDATE_LOW; },
+      [=](int i) { return lineitems->recieptdate[i] < RECEIPTDATE_HIGH; });
+  for (int i = 0; i < 5; i++) {
+    adaptive(orders, lineitems, filter);
+  }
+  stats.print("Q12");
+
   delete lineitems;
   delete orders;
 
@@ -10,8 +10,8 @@
   part
   WHERE
   l_partkey = p_partkey
-  AND l_shipdate >= date '1495-09-01'
-  AND l_shipdate < date '1495-09-01' + interval '1' month;
+  AND l_shipdate >= date '1995-09-01'
+  AND l_shipdate < date '1995-09-01' + interval '1' month;
 
 */
 #include <string>
@@ -27,6 +27,9 @@
 #include <iostream>
 
 #include "utils.h"
+#include "pipeline.h"
+#include "bitmap.h"
+#include "key_index.h"
 
 #include "../hashtable/dict.h"
 
@@ -34,8 +37,6 @@
 
 #include <omp.h>
 
-#define NUM_PARALLEL_THREADS 1
-
 using namespace std;
 
 // Global variables.
@@ -45,104 +46,102 @@ int num_lineitems;
 // Scale factor.
 int SF;
 
+// l_shipdate >= date '1995-09-01'
+// and l_shipdate < date '1995-09-01' + interval '1' month
+constexpr date_t SHIPDATE_LOW = make_date(1995, 9, 1);
+constexpr date_t SHIPDATE_HIGH = date_add_months(SHIPDATE_LOW, 1);
+
+// Revenue sums, scaled by 10^4.
 struct q_result {
-    double sum;
-    double dived;
+    decimal_sum_t sum;
+    decimal_sum_t dived;
 };
 
+// Built at load time: the partkey range, and whether the part is a promo
+// part, as bit partkey - part_index->min_key.
+KeyIndex* part_index;
+Bitmap* promo;
+
 /**
- * Builds a dictionary mapping column values to column index
- * @param column the keys to index
- * @param size the length
- * @return index lookup table
+ * Projects p_type like 'PROMO%' into a bitmap aligned to partkey.
+ * @param p the parts table
+ * @param index the partkey index of p
+ * @return the bitmap, with bit partkey - index.min_key set for promo parts
  */
-Dict<int, long>& build_index(int* column, int *values, long size){
-    Dict<int, long> *d = new Dict<int, long>();
-    for(long i = 0; i < size; i++){
-        d->put(column[i], values[i]);
+Bitmap* build_promo_bitmap(Part* p, const KeyIndex& index) {
+    Bitmap* promo = new Bitmap(index.max_key - index.min_key + 1);
+    if (index.dense) {
+        promo->build([&](int i) { return p->promo_str[i] != 0; });
+    } else {
+        for (int i = 0; i < index.rows; i++) {
+            if (p->promo_str[i]) {
+                promo->set(p->partkey[i] - index.min_key);
+            }
+        }
     }
-    return *d;
+    return promo;
 }
 
 
-struct q_result execute_query(
-        Part *p,
-        Lineitem *l,
-        Dict<int, long>& pk_index,
-        int tid);
-
-double run_parallel(Part *p, Lineitem *l) {
-    Dict<int, long>& pk_index = build_index(p->partkey, p->promo_str, SF * PARTS_PER_SF);
-    struct q_result promo_revenue;
-    promo_revenue.sum = 0;
-    promo_revenue.dived = 0;
-#pragma omp parallel for
-    for (int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-        struct q_result r = execute_query(p, l, pk_index, i);
-#pragma omp critical
-        {
-            promo_revenue.sum += r.sum;
-            promo_revenue.dived += r.dived;
-        }
-    }
-    return promo_revenue.sum / promo_revenue.dived;
+void execute_query(
+        LineitemByShipdate *l,
+        struct q_result& r,
+        int start,
+        int end);
+
+struct q_result run_parallel(Lineitem *l) {
+    struct q_result empty;
+    empty.sum = 0;
+    empty.dived = 0;
+    return morsel_reduce(num_lineitems, empty,
+            [&](struct q_result& r, int start, int end) {
+                execute_query(l->by_shipdate, r, start, end);
+            },
+            [](struct q_result& promo_revenue, const struct q_result& r) {
+                promo_revenue.sum += r.sum;
+                promo_revenue.dived += r.dived;
+            });
 }
 
 /**
  * Executes tpch query 14
- * Note that the parts table is already sorted
- * by partkey. The index of the row for a particular
- * partkey is partkey - 1.
- * @param p The parts table
+ * The join with part only needs p_type, so it is a semi-join with the
+ * promo bitmap, probed by partkey.
  * @param l The line items table
- * @return  The revenue
+ * @param r Accumulates the revenue of the rows [start, end)
  */
-struct q_result execute_query( 
-        Part *p,
-        Lineitem *l,
-        Dict<int, long>& pk_index,
-        int tid) {
-
-    struct q_result r;
-    r.sum = 0;
-    r.dived = 0;
-
-    int start = (num_lineitems / NUM_PARALLEL_THREADS) * tid;
-    int end = start + (num_lineitems / NUM_PARALLEL_THREADS);
-    if (tid == NUM_PARALLEL_THREADS - 1) {
-        end = num_lineitems;
-    }
-
-    for (int i = start; i < end; i++) {
-        int p_type = *(pk_index.get(l->partkey[i]));
-        int l_shipdate = l->shipdate[i];
-        if (l_shipdate >= 19950901 &&
-                l_shipdate < 19951001) {
-            double sum = l->extendedprice[i] * (1.0 - l->discount[i]);
-            r.dived += sum;
-            r.sum += p_type ? sum : 0;
-        }
-    }
-    return r;
-
+void execute_query(
+        LineitemByShipdate *l,
+        struct q_result& r,
+        int start,
+        int end) {
+    auto revenue = [&](int i) {
+        return (decimal_sum_t) l->extendedprice[i] * (DECIMAL_SCALE - l->discount[i]);
+    };
+    l->shipdate_zones.scan(start, end, SHIPDATE_LOW, SHIPDATE_HIGH,
+            [&](int run_start, int run_end) {
+        pipeline_scan(run_start, run_end, [&](Selection& s) {
+            s.select_range(l->shipdate, SHIPDATE_LOW, SHIPDATE_HIGH);
+            r.dived += s.sum(revenue);
+            s.select_bitmap(*promo, l->partkey, part_index->min_key);
+            r.sum += s.sum(revenue);
+        });
+    });
 }
 void load_data_q14(string data_dir, Part* parts, Lineitem* lineitems) {
-    string fpath = data_dir + "/part.tbl";
-    std::cout << "Loading tables from path : " << fpath << std::endl;
-    FILE* parts_tbl = fopen(fpath.c_str(), "r");
-    load_parts(parts, parts_tbl, 0);
-    fclose(parts_tbl);
-
-    fpath = data_dir + "/lineitem.tbl";
-    std::cout << "Loading tables from path : " << fpath << std::endl;
-    FILE* lineitem_tbl = fopen(fpath.c_str(), "r");
-    num_lineitems = load_lineitems(lineitems, lineitem_tbl, 0);
-    fclose(lineitem_tbl);
+    std::cout << "Loading tables from path : " << data_dir << std::endl;
+    int num_parts = load_part_table(parts, data_dir, SF);
+    num_lineitems = load_lineitem_table(lineitems, data_dir, SF);
+    // The one-month shipdate range is a few zones of the shipdate order.
+    build_shipdate_projection(lineitems, num_lineitems);
+    part_index = new KeyIndex(parts->partkey, num_parts);
+    part_index->print("Partkey");
+    promo = build_promo_bitmap(parts, *part_index);
 }
 
 int main(int argc, char **argv) {
     if (!load_sf(argc, argv, SF)) {
-        printf("Run as ./14 -sf <SF>\n");
+        printf("Run as ./14 -sf <SF> [-nosnapshot]\n");
         return 0;
     }
 
@@ -154,11 +153,11 @@ int main(int argc, char **argv) {
     printf("Printing Lineitems First 10 rows:\n");
     printf("orderkey | quantity | extendedprice | discount | shipinstruct | shipmode | \n");
     for (int i = 0; i < 10; i++) {
-        printf("%d | %d | %lf | %lf | %d | %d |\n",
+        printf("%d | %d | %s | %s | %d | %d |\n",
                 lineitems->orderkey[i],
                 lineitems->quantity[i],
-                lineitems->extendedprice[i],
-                lineitems->discount[i],
+                format_decimal(lineitems->extendedprice[i], 2).c_str(),
+                format_decimal(lineitems->discount[i], 2).c_str(),
                 lineitems->shipinstruct[i],
                 lineitems->shipmode[i]);
     }
@@ -174,13 +173,20 @@ int main(int argc, char **argv) {
                 parts->container[i]);
     }
 
+    printf("Shipdate zones scanned: %d of %d\n",
+            lineitems->by_shipdate->shipdate_zones.matching(SHIPDATE_LOW, SHIPDATE_HIGH),
+            lineitems->by_shipdate->shipdate_zones.num_zones);
+
     struct timeval before, after, diff;
-    double res;
+    struct q_result res;
     for (int i = 0; i < 5; i++) {
         gettimeofday(&before, 0);
-        res = run_parallel(parts, lineitems);
+        res = run_parallel(lineitems);
         gettimeofday(&after, 0);
         timersub(&after, &before, &diff);
-        printf("Q14 Complete: %ld.%06ld res=%lf\n", (long) diff.tv_sec, (long) diff.tv_usec, res);
+        // promo_revenue = 100.00 * sum / dived, which is NULL without lines
+        // in the shipdate range.
+        printf("Q14 Complete: %ld.%06ld res=%s\n", (long) diff.tv_sec, (long) diff.tv_usec,
+                res.dived != 0 ? format_decimal(100 * res.sum, 0, 2, res.dived).c_str() : "NULL");
     }
 }
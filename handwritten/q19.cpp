@@ -49,6 +49,8 @@ where
 #include <iostream>
 
 #include "utils.h"
+#include "filter.h"
+#include "pipeline.h"
 
 #include "../hashtable/dict.h"
 
@@ -56,128 +58,182 @@ where
 
 #include <omp.h>
 
-#define NUM_PARALLEL_THREADS 16 
-
 using namespace std;
 
 // Global variables.
 // Number of rows in the lineitems table.
 int num_lineitems;
+// Number of rows in the parts table.
+int num_parts;
 
 
 // Scale factor.
 int SF;
 
 /**
- * Builds a dictionary mapping column values to column index
- * @param column the keys to index
- * @param size the length
- * @return index lookup table
+ * Checks the three disjuncts on part and quantity for the lineitem row i.
+ * The lineitem conjuncts they share (shipinstruct and shipmode) are left to
+ * the caller.
  */
- Dict<int, long>& build_index(int* column, long size){
-  Dict<int, long> *d = new Dict<int, long>();
-  for(long i = 0; i < size; i++){
-    d->put(column[i], i);
-  }
-  return *d;
+inline bool part_matches(Part *p, Lineitem *l, int i) {
+  int pi = l->partindex[i];
+  int p_brand = p->brand[pi];
+  int p_container = p->container[pi];
+  int p_size = p->size[pi];
+  int l_quantity = l->quantity[i];
+  return (p_brand == 12 &&
+          (p_container == 11 || p_container == 16 || p_container == 17 || p_container == 13) &&
+          (l_quantity >= 1 && l_quantity <= 11) &&
+          (p_size >= 1 && p_size <= 5)) ||
+         (p_brand == 23 &&
+          (p_container == 24 || p_container == 26 || p_container == 23 || p_container == 27) &&
+          (l_quantity >= 10 && l_quantity <= 20) &&
+          (p_size >= 1 && p_size <= 10)) ||
+         (p_brand == 34 &&
+          (p_container == 31 || p_container == 36 || p_container == 37 || p_container == 33) &&
+          (l_quantity >= 20 && l_quantity <= 30) &&
+          (p_size >= 1 && p_size <= 15));
+}
+
+/**
+ * Checks the part side of the three disjuncts, brand, container and size, for
+ * the part row pi. A lineitem row can only match if its part does.
+ */
+inline bool part_filter(Part *p, int pi) {
+  int p_brand = p->brand[pi];
+  int p_container = p->container[pi];
+  int p_size = p->size[pi];
+  return (p_brand == 12 &&
+          (p_container == 11 || p_container == 16 || p_container == 17 || p_container == 13) &&
+          (p_size >= 1 && p_size <= 5)) ||
+         (p_brand == 23 &&
+          (p_container == 24 || p_container == 26 || p_container == 23 || p_container == 27) &&
+          (p_size >= 1 && p_size <= 10)) ||
+         (p_brand == 34 &&
+          (p_container == 31 || p_container == 36 || p_container == 37 || p_container == 33) &&
+          (p_size >= 1 && p_size <= 15));
 }
 
+// The revenue of a run, and the rows left after each stage of its pipeline.
+struct Q19State {
+  decimal_sum_t revenue;
+  long rows;
+  long lineitem_passed;
+  long part_passed;
+  long matched;
+};
 
-double execute_query(
+void execute_query(
         Part *p,
         Lineitem *l,
-	Dict<int, long>& pk_index,
-	int tid);
-
-int run_parallel(Part *p, Lineitem *l) {
-  Dict<int, long>& pk_index = build_index(p->partkey, SF * PARTS_PER_SF);
-double revenue = 0.0;
-#pragma omp parallel for
-	for (int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-		double result = execute_query(p, l, pk_index, i);
-		#pragma omp critical
-		{
-		revenue += result;
-		}
-	}
-return revenue;
+        const Bitmap& parts,
+	int start,
+	int end,
+        Q19State& state);
+
+/**
+ * Runs the query over all lineitems. The part side of the predicate is
+ * evaluated first, into a bitmap over the part rows: at 200K parts per SF it
+ * is 25 KB per SF, so the lineitems probe it from L1 or L2 rather than
+ * gathering three part columns per row.
+ */
+Q19State run_parallel(Part *p, Lineitem *l) {
+  Bitmap parts(num_parts);
+  parts.build([&](int pi) { return part_filter(p, pi); });
+
+  Q19State init = {0, 0, 0, 0, 0};
+  return morsel_reduce(num_lineitems, init,
+      [&](Q19State& state, int start, int end) {
+        execute_query(p, l, parts, start, end, state);
+      },
+      [](Q19State& state, const Q19State& s) {
+        state.revenue += s.revenue;
+        state.rows += s.rows;
+        state.lineitem_passed += s.lineitem_passed;
+        state.part_passed += s.part_passed;
+        state.matched += s.matched;
+      });
 }
 
 /**
  * Executes tpch query 19
- * Note that the parts table is already sorted
- * by partkey. The index of the row for a particular
- * partkey is partkey - 1.
+ * Parts are joined through the lineitem join index partindex. The lineitem
+ * predicates run first, then the surviving rows probe the part bitmap with
+ * vector gathers, and only the rows whose part passes look up the part
+ * columns to check the disjuncts against their quantity.
  * @param p The parts table
  * @param l The line items table
- * @return  The revenue
+ * @param parts The part rows passing part_filter
+ * @param state Adds the revenue of the rows [start, end), scaled by 10^4
  */
-double execute_query(
+void execute_query(
         Part *p,
         Lineitem *l,
-	Dict<int, long>& pk_index,
-	int tid) {
-  double revenue = 0.0;
-
-  int start = (num_lineitems / NUM_PARALLEL_THREADS) * tid;
-  int end = start + (num_lineitems / NUM_PARALLEL_THREADS);
-  if (tid == NUM_PARALLEL_THREADS - 1) {
-    end = num_lineitems;
-  }
+        const Bitmap& parts,
+	int start,
+	int end,
+        Q19State& state) {
+  pipeline_scan(start, end, [&](Selection& s) {
+    state.rows += s.rows;
+    s.select_range(l->shipinstruct, 1, 2);
+    s.select_range(l->shipmode, 2, 4);
+    s.select_range(l->quantity, 1, 31);
+    state.lineitem_passed += s.n;
+    s.select_bitmap(parts, l->partindex, 0);
+    state.part_passed += s.n;
+    s.select([&](int i) { return part_matches(p, l, i); });
+    state.matched += s.n;
+    state.revenue += s.sum([&](int i) {
+      return (decimal_sum_t) l->extendedprice[i] * (DECIMAL_SCALE - l->discount[i]);
+    });
+  });
+}
 
-  for (int i = start; i < end; i++) {
-    int pi = *(pk_index.get(l->partkey[i]));
-    int p_brand = p->brand[pi];
-    int p_container = p->container[pi];
-    int p_size = p->size[pi];
-    int l_quantity = l->quantity[i];
-    int l_shipmode = l->shipmode[i];
-    int l_shipinstruct = l->shipinstruct[i];
-    if ((p_brand == 12 &&
-         (p_container == 11 || p_container == 16 || p_container == 17 || p_container == 13) &&
-         (l_quantity >= 1 && l_quantity <= 11) &&
-         (p_size >= 1 && p_size <= 5) &&
-         l_shipinstruct == 1 &&
-         (l_shipmode == 2 || l_shipmode == 3)
-        ) ||
-        (p_brand == 23 &&
-         (p_container == 24 || p_container == 26 || p_container == 23 || p_container == 27) &&
-         (l_quantity >= 10 && l_quantity <= 20) &&
-         (p_size >= 1 && p_size <= 10) &&
-         l_shipinstruct == 1 &&
-         (l_shipmode == 2 || l_shipmode == 3)
-        ) ||
-        (p_brand == 34 &&
-         (p_container == 31 || p_container == 36 || p_container == 37 || p_container == 33) &&
-         (l_quantity >= 20 && l_quantity <= 30) &&
-         (p_size >= 1 && p_size <= 15) &&
-         l_shipinstruct == 1 &&
-         (l_shipmode == 2 || l_shipmode == 3)
-        )
-         ) {
-      revenue += l->extendedprice[i] * (1.0 - l->discount[i]);
-    }
-  }
-  return revenue;
+/** Prints how many rows each stage of execute_query dropped. */
+void print_early_filter(const Q19State& state) {
+  double rows = state.rows > 0 ? state.rows : 1;
+  printf("Q19 early filter: %ld rows, %.2f%% pass the lineitem predicates, "
+         "%.3f%% the part bitmap, %.3f%% match\n",
+         state.rows, 100.0 * state.lineitem_passed / rows,
+         100.0 * state.part_passed / rows, 100.0 * state.matched / rows);
+  printf("  %.3f%% of rows filtered before the part gather\n",
+         100.0 * (state.rows - state.part_passed) / rows);
+}
 
+// The Q19 conjuncts, for the adaptive filter. The lineitem conjuncts shared
+// by the three disjuncts are split out; the last predicate is the disjunction
+// itself, which looks up the part.
+static const char* Q19_PREDICATES[] = {
+  "l_shipinstruct = 'DELIVER IN PERSON'",
+  "l_shipmode in ('AIR', 'AIR REG')",
+  "l_quantity between 1 and 30",
+  "part brand, container and size",
+};
+
+// Runs the query with the adaptive filter.
+template <typename Filter>
+decimal_sum_t run_adaptive(Lineitem *l, const Filter& filter) {
+  return morsel_reduce(num_lineitems, (decimal_sum_t) 0,
+      [&](decimal_sum_t& revenue, int start, int end) {
+        filter.run(start, end, [&](const int *sel, int n) {
+          for (int k = 0; k < n; k++) {
+            revenue += (decimal_sum_t) l->extendedprice[sel[k]] * (DECIMAL_SCALE - l->discount[sel[k]]);
+          }
+        });
+      },
+      [](decimal_sum_t& revenue, decimal_sum_t r) { revenue += r; });
 }
+
 void load_data_q19(string data_dir, Part* parts, Lineitem* lineitems) {
-  string fpath = data_dir + "/part.tbl";
-  std::cout << "Loading tables from path : " << fpath << std::endl;
-  FILE* parts_tbl = fopen(fpath.c_str(), "r");
-  load_parts(parts, parts_tbl, 0);
-  fclose(parts_tbl);
-
-  fpath = data_dir + "/lineitem.tbl";
-  std::cout << "Loading tables from path : " << fpath << std::endl;
-  FILE* lineitem_tbl = fopen(fpath.c_str(), "r");
-  num_lineitems = load_lineitems(lineitems, lineitem_tbl, 0);
-  fclose(lineitem_tbl);
+  std::cout << "Loading tables from path : " << data_dir << std::endl;
+  num_parts = load_part_table(parts, data_dir, SF);
+  num_lineitems = load_lineitem_table(lineitems, data_dir, SF);
+  build_part_join_index(lineitems, num_lineitems, parts, num_parts, data_dir, SF);
 }
 
 int main(int argc, char **argv) {
   if (!load_sf(argc, argv, SF)) {
-    printf("Run as ./19 -sf <SF>\n");
+    printf("Run as ./19 -sf <SF> [-nosnapshot]\n");
     return 0;
   }
 
@@ -189,11 +245,11 @@ int main(int argc, char **argv) {
   printf("Printing Lineitems First 10 rows:\n");
   printf("orderkey | quantity | extendedprice | discount | shipinstruct | shipmode | \n");
   for (int i = 0; i < 10; i++) {
-    printf("%d | %d | %lf | %lf | %d | %d |\n",
+    printf("%d | %d | %s | %s | %d | %d |\n",
            lineitems->orderkey[i],
            lineitems->quantity[i],
-           lineitems->extendedprice[i],
-           lineitems->discount[i],
+           format_decimal(lineitems->extendedprice[i], 2).c_str(),
+           format_decimal(lineitems->discount[i], 2).c_str(),
            lineitems->shipinstruct[i],
            lineitems->shipmode[i]);
   }
@@ -209,12 +265,32 @@ int main(int argc, char **argv) {
   }
 
   struct timeval before, after, diff;
-  double res;
+  Q19State state;
+  for (int i = 0; i < 5; i++) {
+    gettimeofday(&before, 0);
+    state = run_parallel(parts, lineitems);
+    gettimeofday(&after, 0);
+    timersub(&after, &before, &diff);
+    printf("Q19 Complete: %ld.%06ld res=%s\n", (long) diff.tv_sec, (long) diff.tv_usec,
+           format_decimal(state.revenue, 4).c_str());
+  }
+  print_early_filter(state);
+
+  decimal_sum_t res;
+
+  FilterStats stats(Q19_PREDICATES, 4);
+  auto filter = make_filter(&stats,
+      [=](int i) { return lineitems->shipinstruct[i] == 1; },
+      [=](int i) { return lineitems->shipmode[i] == 2 || lineitems->shipmode[i] == 3; },
+      [=](int i) { return lineitems->quantity[i] >= 1 && lineitems->quantity[i] <= 30; },
+      [=](int i) { return part_matches(parts, lineitems, i); });
   for (int i = 0; i < 5; i++) {
     gettimeofday(&before, 0);
-    res = run_parallel(parts, lineitems);
+    res = run_adaptive(lineitems, filter);
     gettimeofday(&after, 0);
     timersub(&after, &before, &diff);
-    printf("Q19 Complete: %ld.%06ld res=%lf\n", (long) diff.tv_sec, (long) diff.tv_usec, res);
+    printf("Q19 adaptive: %ld.%06ld res=%s\n", (long) diff.tv_sec, (long) diff.tv_usec,
+           format_decimal(res, 4).c_str());
   }
+  stats.print("Q19");
 }
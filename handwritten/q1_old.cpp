@@ -68,7 +68,7 @@ int q1(struct LineItem *data, size_t length) {
     memset(entries, 0, sizeof(entries));
 
     for (size_t i = 0; i < length; i++) {
-        if (data[i].l_shipdate <= 19981201 - 90) {
+        if (data[i].l_shipdate <= 19980902) {
 
             struct Q1Entry *entry = &entries[data[i].l_returnflag % 3][data[i].l_linestatus & 1];
             entry->sum_qty += data[i].l_quantity;
@@ -104,7 +104,7 @@ int q1_worker(struct LineItem *data,
   }
 
   for (size_t i = start; i < end; i++) {
-    if (data[i].l_shipdate <= 19981201 - 90) {
+    if (data[i].l_shipdate <= 19980902) {
       struct PaddedQ1Entry *entry =
         &entries[data[i].l_returnflag % 3][data[i].l_linestatus & 1];
 
@@ -151,7 +151,7 @@ int q1_simd_interior(struct LineItem *data, size_t length) {
     memset(entries, 0, sizeof(entries));
 
     for (size_t i = 0; i < length; i++) {
-        if (data[i].l_shipdate <= 19981201 - 90) {
+        if (data[i].l_shipdate <= 19980902) {
             struct PaddedQ1Entry *entry = &entries[data[i].l_returnflag & 1][data[i].l_linestatus & 1];
 
             __m256i v_entry = _mm256_lddqu_si256((const __m256i *)entry);
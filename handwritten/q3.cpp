@@ -37,24 +37,31 @@ order by
 #include <iostream>
 #include <algorithm>
 #include "utils.h"
+#include "topk.h"
+#include "bitmap.h"
+#include "pipeline.h"
 using namespace std;
 
-#define NUM_PARALLEL_THREADS 24
-
 // Global variables.
 // Number of rows in the lineitems table.
 int num_lineitems;
+// Number of rows in the orders and customers tables.
+int num_orders;
+int num_customers;
 
 // Scale factor.
 int SF;
 
+// o_orderdate < date '1995-03-24' and l_shipdate > date '1995-03-24'
+constexpr date_t CUTOFF_DATE = make_date(1995, 3, 24);
+
 struct HashEntry {
-  int orderdate;
+  date_t orderdate;
   int shippriority;
-  double revenue;
+  decimal_sum_t revenue;  // Scaled by 10^4.
   bool joined;
 
-  HashEntry(int odate, int shipp) {
+  HashEntry(date_t odate, int shipp) {
     orderdate = odate;
     shippriority = shipp;
     revenue = 0;
@@ -64,10 +71,9 @@ struct HashEntry {
 
 void filter_and_hash_customers(
     Customer* c,
-    int partition,
+    int start,
+    int end,
     unordered_set<int>* target_customers) {
-  int start = (partition * CUSTOMERS_PER_SF * SF) / NUM_PARALLEL_THREADS,
-      end = ((partition + 1) * CUSTOMERS_PER_SF * SF) / NUM_PARALLEL_THREADS;
   int count = 0;
   for (int i = start; i < end; i++) {
     if (c->mktsegment[i] == 1) {
@@ -82,12 +88,11 @@ void filter_and_hash_customers(
 
 void join_with_orders(
     Order* o,
-    int partition,
+    int start,
+    int end,
     unordered_set<int>* customers,
     unordered_map<int, HashEntry*>* orders_map) {
-  int cutoff_date = 19950324;
-  int start = (partition * ORDERS_PER_SF * SF)/NUM_PARALLEL_THREADS,
-      end = ((partition + 1) * ORDERS_PER_SF * SF)/NUM_PARALLEL_THREADS;
+  date_t cutoff_date = CUTOFF_DATE;
   for (int i = start; i < end; i++) {
     if (o->orderdate[i] < cutoff_date &&
         !(customers->find(o->custkey[i] - 1) == customers->end()))  {
@@ -102,12 +107,11 @@ void join_with_orders(
 
 void join_with_lineitems(
     Lineitem* l,
-    int partition,
+    int start,
+    int end,
     unordered_map<int, HashEntry*>* orders_map) {
-  int cutoff_date = 19950324;
+  date_t cutoff_date = CUTOFF_DATE;
   unordered_map<int, HashEntry*>::iterator it;
-  int start = (partition * num_lineitems) / NUM_PARALLEL_THREADS,
-      end = ((partition + 1) * num_lineitems) / NUM_PARALLEL_THREADS;
   int count = 0;
   for (int i = start; i < end; i++) {
     if (l->shipdate[i] > cutoff_date) {
@@ -115,7 +119,8 @@ void join_with_lineitems(
       it = orders_map->find(l->orderkey[i]);
       if (it != orders_map->end()) {
         HashEntry* order = it->second;
-        order->revenue += l->extendedprice[i] * (1 - l->discount[i]);
+        order->revenue +=
+          (decimal_sum_t) l->extendedprice[i] * (DECIMAL_SCALE - l->discount[i]);
         order->joined = true;
       }
     }
@@ -128,20 +133,17 @@ void with_sync(Customer* customers, Order* orders, Lineitem* lineitems) {
   unordered_set<int>* target_customers = new unordered_set<int>();
   unordered_map<int, HashEntry*>* orders_map = new unordered_map<int, HashEntry*>();
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    filter_and_hash_customers(customers, i, target_customers);
-  }
+  morsel_for(num_customers, [&](int start, int end) {
+    filter_and_hash_customers(customers, start, end, target_customers);
+  });
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    join_with_orders(orders, i, target_customers, orders_map);
-  }
+  morsel_for(num_orders, [&](int start, int end) {
+    join_with_orders(orders, start, end, target_customers, orders_map);
+  });
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    join_with_lineitems(lineitems, i, orders_map);
-  }
+  morsel_for(num_lineitems, [&](int start, int end) {
+    join_with_lineitems(lineitems, start, end, orders_map);
+  });
 
   int count = 0;
   unordered_map<int, HashEntry*>::iterator result_it;
@@ -169,12 +171,11 @@ void run_partition(
     Customer* c,
     Order* o,
     Lineitem* l,
-    int partition,
-    unordered_map<int, double>* orders_map) {
-  int cutoff_date = 19950324;
-  int start = (partition * num_lineitems) / NUM_PARALLEL_THREADS,
-      end = ((partition + 1) * num_lineitems) / NUM_PARALLEL_THREADS;
-  int order_index = binary_search(o->orderkey, ORDERS_PER_SF * SF, l->orderkey[start]);
+    int start,
+    int end,
+    unordered_map<int, decimal_sum_t>* orders_map) {
+  date_t cutoff_date = CUTOFF_DATE;
+  int order_index = binary_search(o->orderkey, num_orders, l->orderkey[start]);
   for (int i=start; i<end; i++) {
     if (l->shipdate[i] > cutoff_date) {
       int orderkey = l->orderkey[i];
@@ -184,7 +185,8 @@ void run_partition(
         if (c->mktsegment[custkey] == 1) {
 #pragma omp critical(mapupdate)
           {
-            (*orders_map)[orderkey] += l->extendedprice[i] * (1 - l->discount[i]);
+            (*orders_map)[orderkey] +=
+              (decimal_sum_t) l->extendedprice[i] * (DECIMAL_SCALE - l->discount[i]);
           }
         }
       }
@@ -195,18 +197,17 @@ void run_partition(
 void assuming_sorted(Customer* customers, Order* orders, Lineitem* lineitems) {
   struct timeval before, after, diff;
   gettimeofday(&before, 0);
-  unordered_map<int, double>* result = new unordered_map<int, double>();
+  unordered_map<int, decimal_sum_t>* result = new unordered_map<int, decimal_sum_t>();
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    run_partition(customers, orders, lineitems, i, result);
-  }
+  morsel_for(num_lineitems, [&](int start, int end) {
+    run_partition(customers, orders, lineitems, start, end, result);
+  });
 
   gettimeofday(&after, 0);
   timersub(&after, &before, &diff);
 
   int count = 0;
-  unordered_map<int, double>::iterator result_it;
+  unordered_map<int, decimal_sum_t>::iterator result_it;
   for (result_it = result->begin(); result_it != result->end(); result_it++) {
     count++;
   }
@@ -216,25 +217,50 @@ void assuming_sorted(Customer* customers, Order* orders, Lineitem* lineitems) {
   delete result;
 }
 
+// Rows of the result printed.
+#define Q3_LIMIT 10
+
+struct Result {
+  int orderkey;
+  decimal_sum_t revenue;  // Scaled by 10^4.
+  date_t orderdate;
+  int shippriority;
+};
+
+// Sort desc on revenue, asc on orderdate, then asc on orderkey so that the
+// top rows do not depend on how the orders were split across threads.
+bool operator<(const Result& lhs, const Result& rhs) {
+  if (lhs.revenue != rhs.revenue) {
+    return lhs.revenue > rhs.revenue;
+  } else if (lhs.orderdate != rhs.orderdate) {
+    return lhs.orderdate < rhs.orderdate;
+  } else {
+    return lhs.orderkey < rhs.orderkey;
+  }
+}
+
+Result make_result(Order* o, int i, decimal_sum_t revenue) {
+  Result res;
+  res.orderkey = o->orderkey[i];
+  res.revenue = revenue;
+  res.orderdate = o->orderdate[i];
+  res.shippriority = o->shippriority[i];
+  return res;
+}
+
 void run_partition_nosync(
     Customer* c,
     Order* o,
     Lineitem* l,
-    int partition,
-    double* result) {
-  int cutoff_date = 19950324;
-  int start = (partition * ORDERS_PER_SF * SF) / NUM_PARALLEL_THREADS,
-      end = ((partition + 1) * ORDERS_PER_SF * SF) / NUM_PARALLEL_THREADS;
+    int start,
+    int end,
+    decimal_sum_t* result) {
+  date_t cutoff_date = CUTOFF_DATE;
 
   // Start point in the lineitem array.
-  int li_index;
-  if (NUM_PARALLEL_THREADS > 1) {
-  li_index = binary_search(l->orderkey, num_lineitems, o->orderkey[start]);
+  int li_index = binary_search(l->orderkey, num_lineitems, o->orderkey[start]);
   while(li_index > 0 && l->orderkey[li_index - 1] == l->orderkey[li_index])
     li_index--;
-  } else {
-    li_index = 0;
-  }
 
   for (int i=start; i<end; i++) {
     if (o->orderdate[i] < cutoff_date) {
@@ -244,7 +270,8 @@ void run_partition_nosync(
         while (l->orderkey[li_index] != orderkey) li_index++;
         while (l->orderkey[li_index] == orderkey) {
           if (l->shipdate[li_index] > cutoff_date) {
-            result[i] += l->extendedprice[li_index] * (1 - l->discount[li_index]);
+            result[i] += (decimal_sum_t) l->extendedprice[li_index] *
+              (DECIMAL_SCALE - l->discount[li_index]);
           }
           li_index++;
         }
@@ -253,69 +280,75 @@ void run_partition_nosync(
   }
 }
 
+// Pushes the orders of [start, end) with qualifying lineitems, which are
+// found via li_start and li_end, into top. customers holds the bit of each
+// customer row in the market segment.
 void run_partition_nosync_joined(
-    Customer* c,
+    const Bitmap& customers,
     Order* o,
     Lineitem* l,
-    int partition,
-    double* result) {
-  int cutoff_date = 19950324;
-  int start = (partition * ORDERS_PER_SF * SF) / NUM_PARALLEL_THREADS,
-      end = ((partition + 1) * ORDERS_PER_SF * SF) / NUM_PARALLEL_THREADS;
-
-  for (int i=start; i<end; i++) {
-    if (o->orderdate[i] < cutoff_date) {
-      int custkey = o->custkey[i] - 1;
-      if (c->mktsegment[custkey] == 1) {
-        int orderkey = o->orderkey[i];
-        for (int li_index = o->li_start[i]; li_index < o->li_end[i]; li_index++) {
-          if (l->shipdate[li_index] > cutoff_date) {
-            result[i] += l->extendedprice[li_index] * (1 - l->discount[li_index]);
-          }
+    int start,
+    int end,
+    TopK<Result>& top) {
+  date_t cutoff_date = CUTOFF_DATE;
+
+  pipeline_scan(start, end, [&](Selection& s) {
+    s.select_range(o->orderdate, 0, cutoff_date);
+    s.select_bitmap(customers, o->custindex, 0);
+    s.for_each([&](int i) {
+      decimal_sum_t revenue = 0;
+      bool joined = false;
+      for (int li_index = o->li_start[i]; li_index < o->li_end[i]; li_index++) {
+        if (l->shipdate[li_index] > cutoff_date) {
+          revenue += (decimal_sum_t) l->extendedprice[li_index] *
+            (DECIMAL_SCALE - l->discount[li_index]);
+          joined = true;
         }
       }
-    }
-  }
+      if (joined) {
+        top.push(make_result(o, i, revenue));
+      }
+    });
+  });
 }
 
 void assuming_sorted_nosync(Customer* customers, Order* orders, Lineitem* lineitems) {
   struct timeval before, after, diff;
   gettimeofday(&before, 0);
-  double* result = new double[ORDERS_PER_SF * SF];
-  memset(result, 0, sizeof(double) * ORDERS_PER_SF * SF);
+  decimal_sum_t* result = new decimal_sum_t[num_orders];
+  memset(result, 0, sizeof(decimal_sum_t) * num_orders);
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    run_partition_nosync(customers, orders, lineitems, i, result);
-  }
+  morsel_for(num_orders, [&](int start, int end) {
+    run_partition_nosync(customers, orders, lineitems, start, end, result);
+  });
 
   gettimeofday(&after, 0);
   timersub(&after, &before, &diff);
 
   int count = 0;
-  for (int i=0; i<ORDERS_PER_SF*SF; i++) {
-    if (result[i] != 0.0) count++;
+  for (int i=0; i<num_orders; i++) {
+    if (result[i] != 0) count++;
   }
 
   printf("Result cardinality: %d\n", count);
   printf("Q3 Assuming Sorted No Sync: %ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
-  delete result;
+  delete[] result;
 }
 
-struct Result {
-  int orderkey;
-  double revenue;
-  int orderdate;
-  int shippriority;
-};
+void merge_top(TopK<Result>& top, const TopK<Result>& t) {
+  top.merge(t);
+}
 
-// Sort desc on revenue, asc on orderdate.
-bool operator<(const Result& lhs, const Result& rhs) {
-  if (lhs.revenue != rhs.revenue) {
-    return lhs.revenue > rhs.revenue;
-  } else {
-    return lhs.orderdate < rhs.orderdate;
+void print_top(const TopK<Result>& top) {
+  vector<Result> results = top.sorted();
+  printf("orderkey | revenue | orderdate | shippriority\n");
+  for (size_t i=0; i<results.size(); i++) {
+     printf("%d | %s | %s | %d\n", results[i].orderkey,
+         format_decimal(results[i].revenue, 4).c_str(),
+         format_date(results[i].orderdate).c_str(),
+         results[i].shippriority);
   }
+  printf("Result cardinality: %ld\n", top.pushed);
 }
 
 // Runs the complete query using assuming_sorted method.
@@ -324,107 +357,64 @@ void complete_query(Customer* customers, Order* orders, Lineitem* lineitems) {
 
   gettimeofday(&before, 0);
 
-  double* result = new double[ORDERS_PER_SF * SF];
-  memset(result, 0, sizeof(double) * ORDERS_PER_SF * SF);
+  decimal_sum_t* result = new decimal_sum_t[num_orders];
+  memset(result, 0, sizeof(decimal_sum_t) * num_orders);
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    run_partition_nosync(customers, orders, lineitems, i, result);
-  }
+  morsel_for(num_orders, [&](int start, int end) {
+    run_partition_nosync(customers, orders, lineitems, start, end, result);
+  });
 
-  int count = 0;
-  // TODO: Maybe use vector here ?
-  Result* results = new Result[ORDERS_PER_SF*SF];
-  for (int i=0; i<ORDERS_PER_SF*SF; i++) {
-    if (result[i] != 0.0) {
-      Result& res = results[count];
-      res.orderkey = orders->orderkey[i];
-      res.revenue = result[i];
-      res.orderdate = orders->orderdate[i];
-      res.shippriority = orders->shippriority[i];
-      count++;
-    }
-  }
-
-  sort(results, results + count);
+  TopK<Result> top = morsel_reduce(num_orders, TopK<Result>(Q3_LIMIT),
+      [&](TopK<Result>& t, int start, int end) {
+        for (int i=start; i<end; i++) {
+          if (result[i] != 0) {
+            t.push(make_result(orders, i, result[i]));
+          }
+        }
+      }, merge_top);
 
   gettimeofday(&after, 0);
   timersub(&after, &before, &diff);
 
-  printf("orderkey | revenue | orderdate | shippriority\n");
-  for (int i=0; i<10; i++) {
-     printf("%d | %.2f | %d | %d\n", results[i].orderkey,
-         results[i].revenue, results[i].orderdate, results[i].shippriority);
-  }
-
-  printf("Result cardinality: %d\n", count);
+  print_top(top);
   printf("Q3 Complete: %ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
-  delete result;
+  delete[] result;
 }
 
 // Runs the complete query using assuming_sorted method with prejoined data.
+// The customer filter is semi-joined as a bitmap, and each thread keeps only
+// its top Q3_LIMIT orders.
 void complete_query_joined(Customer* customers, Order* orders, Lineitem *lineitems) {
   struct timeval before, after, diff;
 
   gettimeofday(&before, 0);
-  double* result = new double[ORDERS_PER_SF * SF];
-  memset(result, 0, sizeof(double) * ORDERS_PER_SF * SF);
 
-#pragma omp parallel for
-  for (int i=0; i<NUM_PARALLEL_THREADS; i++) {
-    run_partition_nosync_joined(customers, orders, lineitems, i, result);
-  }
-
-  int count = 0;
-  // TODO: Maybe use vector here ?
-  Result* results = new Result[ORDERS_PER_SF*SF];
-  for (int i=0; i<ORDERS_PER_SF*SF; i++) {
-    if (result[i] != 0.0) {
-      Result& res = results[count];
-      res.orderkey = orders->orderkey[i];
-      res.revenue = result[i];
-      res.orderdate = orders->orderdate[i];
-      res.shippriority = orders->shippriority[i];
-      count++;
-    }
-  }
+  Bitmap target_customers(num_customers);
+  target_customers.build([&](int i) { return customers->mktsegment[i] == 1; });
 
-  sort(results, results + count);
+  TopK<Result> top = morsel_reduce(num_orders, TopK<Result>(Q3_LIMIT),
+      [&](TopK<Result>& t, int start, int end) {
+        run_partition_nosync_joined(target_customers, orders, lineitems, start, end, t);
+      }, merge_top);
 
   gettimeofday(&after, 0);
   timersub(&after, &before, &diff);
 
-  printf("orderkey | revenue | orderdate | shippriority\n");
-  for (int i=0; i<10; i++) {
-     printf("%d | %.2f | %d | %d\n", results[i].orderkey,
-         results[i].revenue, results[i].orderdate, results[i].shippriority);
-  }
-
-  printf("Result cardinality: %d\n", count);
+  print_top(top);
   printf("Q3 Complete: %ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
-  delete result;
 }
 
 void loadData_q3(string data_dir, Customer* customers, Order* orders, Lineitem* lineitems) {
-  string fpath = data_dir + "/customer.tbl";
-  FILE* customer_tbl = fopen(fpath.c_str(), "r");
-  load_customers(customers, customer_tbl, 0, 1, SF);
-  fclose(customer_tbl);
-
-  fpath = data_dir + "/orders.tbl";
-  FILE* order_tbl = fopen(fpath.c_str(), "r");
-  load_orders(orders, order_tbl, 0, 1, SF);
-  fclose(order_tbl);
-
-  fpath = data_dir + "/lineitem.tbl";
-  FILE* lineitem_tbl = fopen(fpath.c_str(), "r");
-  num_lineitems = load_lineitems(lineitems, lineitem_tbl, 0);
-  fclose(lineitem_tbl);
+  num_customers = load_customer_table(customers, data_dir, SF);
+  num_orders = load_order_table(orders, data_dir, SF);
+  num_lineitems = load_lineitem_table(lineitems, data_dir, SF);
+  build_order_join_indexes(lineitems, num_lineitems, orders, num_orders, data_dir, SF);
+  build_customer_join_index(orders, num_orders, customers, num_customers, data_dir, SF);
 }
 
 int main(int argc, char** argv) {
   if (!load_sf(argc, argv, SF)) {
-    printf("Run as ./q3 -sf <SF>\n");
+    printf("Run as ./q3 -sf <SF> [-nosnapshot]\n");
     return 0;
   }
 
@@ -443,15 +433,6 @@ int main(int argc, char** argv) {
 
   //complete_query(customers, orders, lineitems);
 
-  int li_index = 0;
-  for (int i = 0; i < ORDERS_PER_SF * SF; i++) {
-    int orderkey = orders->orderkey[i];
-    while (lineitems->orderkey[li_index] != orderkey) li_index++;
-    orders->li_start[i] = li_index;
-    while (lineitems->orderkey[li_index] == orderkey) li_index++;
-    orders->li_end[i] = li_index;
-  }
-
   printf("Running complete query\n");
 
   for (int i = 0; i < 5; i++) {
@@ -4,147 +4,160 @@
 #include <assert.h>
 #include <sys/time.h>
 
+#include <string>
+
 #include <omp.h>
 
 #include <immintrin.h>
 
-#include "utilold.h"
+#include "utils.h"
+#include "filter.h"
+#include "pipeline.h"
+#include "scan.h"
 
-#define N (12 * 10 * 1000 * 1000)  // Number of input rows
 #define R 1                 // Repeats of each test
 
-#define NUM_PARALLEL_THREADS    4
-
-int l_shipdate[N];
-int l_discount[N];
-int l_quantity[N];
-int l_extendedprice[N];
-
-void q6_print_selectivities(int *l_shipdate,
-    int *l_discount,
-    int *l_quantity,
-    int *l_extendedprice,
-    size_t length) {
-
-  int s_date = 0;
-  int s_quantity = 0;
-  int s_discount = 0;
-
-  int s_total = 0;
-
-  for (size_t i = 0; i < length; i++) {
-
-    short ctr = 0;
+// Number of rows in the lineitems table.
+int num_lineitems;
 
-    if (l_shipdate[i] >= 19940101 && l_shipdate[i] < 19950101) {
-      s_date++;
-      ctr++;
-    }
-
-    if (l_quantity[i] < 24) {
-      s_quantity++;
-      ctr++;
-    }
+// Scale factor.
+int SF;
 
-    if (l_discount[i] >= 5 && l_discount[i] <= 7) {
-      s_discount++;
-      ctr++;
-    }
-
-    if (ctr == 3) {
-      s_total++;
-    }
-  }
+// l_shipdate >= date '1994-01-01'
+// and l_shipdate < date '1994-01-01' + interval '1' year
+constexpr date_t SHIPDATE_LOW = make_date(1994, 1, 1);
+constexpr date_t SHIPDATE_HIGH = date_add_years(SHIPDATE_LOW, 1);
 
-  fprintf(stderr, "quantity: %f, discount:%f, s_date:%f, s_total:%f\n",
-      ((double)s_quantity/(double)length),
-      ((double)s_discount/(double)length),
-      ((double)s_date/(double)length),
-      ((double)s_total/(double)length));
-  fprintf(stderr, "Total rows matching: %d\n", s_total);
+// l_discount between 0.06 - 0.01 and 0.06 + 0.01
+#define DISCOUNT_LOW 5
+#define DISCOUNT_HIGH 7
 
-  printf("Match Rate: %f\n", (double)s_total / (double)length);
-}
+// l_quantity < 24
+#define QUANTITY_HIGH 24
 
 /*
  *
  * Query implementations
  *
+ * All of them return sum(l_extendedprice * l_discount), scaled by 10^4.
+ *
  */
 
-// The baseline
-int q6_columnar(int *l_shipdate, int *l_discount, int *l_quantity,
-    int *l_extendedprice, size_t length) {
-  int result = 0;
-  for (size_t i = 0; i < length; i++) {
-    if (l_shipdate[i] >= 19940101 &&
-        l_shipdate[i] < 19950101 &&
-        l_discount[i] >= 5 &&
-        l_discount[i] <= 7 &&
-        l_quantity[i] < 24) {
-      result += l_extendedprice[i] * l_discount[i];
-    }
+// The query as a template scan, on either table.
+template <typename Table>
+using Q6Scan = Scan<
+    All<Range<COLUMN(Table, shipdate), SHIPDATE_LOW, SHIPDATE_HIGH>,
+        Range<COLUMN(Table, discount), DISCOUNT_LOW, DISCOUNT_HIGH + 1>,
+        Range<COLUMN(Table, quantity), 0, QUANTITY_HIGH> >,
+    SumProduct<COLUMN(Table, extendedprice), COLUMN(Table, discount)> >;
+
+/*
+ * The dispatched kernels.
+ *
+ * Each kernel returns the Q6 sum of the rows [start, end). They differ only
+ * in the instruction set, and q6_kernel_for picks one at run time, so the
+ * binary runs on any x86-64 host and still uses AVX-512 where present. The
+ * vector kernels compare in 32-bit lanes and accumulate the products, each
+ * of which fits 32 bits, in 64-bit lanes.
+ */
+typedef decimal_sum_t (*q6_kernel)(date_t *l_shipdate, small_decimal_t *l_discount,
+    uint8_t *l_quantity, decimal_t *l_extendedprice, int start, int end);
+
+decimal_sum_t q6_kernel_scalar(date_t *l_shipdate, small_decimal_t *l_discount,
+    uint8_t *l_quantity, decimal_t *l_extendedprice, int start, int end) {
+  decimal_sum_t result = 0;
+  for (int i = start; i < end; i++) {
+    result += ((l_shipdate[i] >= SHIPDATE_LOW) &
+        (l_shipdate[i] < SHIPDATE_HIGH) &
+        (l_discount[i] >= DISCOUNT_LOW) &
+        (l_discount[i] <= DISCOUNT_HIGH) &
+        (l_quantity[i] < QUANTITY_HIGH)) * l_extendedprice[i] * l_discount[i];
   }
   return result;
 }
 
-int q6_columnar_reordered_preds(int *l_shipdate,
-    int *l_discount,
-    int *l_quantity,
-    int *l_extendedprice,
-    size_t length) {
-
-  int result = 0;
-
-  for (size_t i = 0; i < length; i++) {
-    if (l_quantity[i] < 24) {
-      if (l_discount[i] >= 5 && l_discount[i] <= 7) {
-        if (l_shipdate[i] >= 19940101 && l_shipdate[i] < 19950101) {
-          result += l_extendedprice[i] * l_discount[i];
-        }
-      }
-    }
+TARGET_SSE4
+decimal_sum_t q6_kernel_sse4(date_t *l_shipdate, small_decimal_t *l_discount,
+    uint8_t *l_quantity, decimal_t *l_extendedprice, int start, int end) {
+  int i;
+
+  const __m128i v_shipdate_lower = _mm_set1_epi32(SHIPDATE_LOW - 1);
+  const __m128i v_shipdate_upper = _mm_set1_epi32(SHIPDATE_HIGH);
+  const __m128i v_discount_lower = _mm_set1_epi32(DISCOUNT_LOW - 1);
+  const __m128i v_discount_upper = _mm_set1_epi32(DISCOUNT_HIGH + 1);
+  const __m128i v_quantity_upper = _mm_set1_epi32(QUANTITY_HIGH);
+
+  __m128i v_sum = _mm_setzero_si128();
+
+  for (i = start; i+4 <= end; i += 4) {
+    int discount, quantity;
+    memcpy(&discount, l_discount + i, 4);
+    memcpy(&quantity, l_quantity + i, 4);
+
+    __m128i v_shipdate = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(l_shipdate + i)));
+    __m128i v_discount = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(discount));
+    __m128i v_quantity = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(quantity));
+
+    __m128i v_p0 = _mm_cmpgt_epi32(v_shipdate, v_shipdate_lower);
+    v_p0 = _mm_and_si128(v_p0, _mm_cmpgt_epi32(v_shipdate_upper, v_shipdate));
+    v_p0 = _mm_and_si128(v_p0, _mm_cmpgt_epi32(v_discount, v_discount_lower));
+    v_p0 = _mm_and_si128(v_p0, _mm_cmpgt_epi32(v_discount_upper, v_discount));
+    v_p0 = _mm_and_si128(v_p0, _mm_cmpgt_epi32(v_quantity_upper, v_quantity));
+
+    __m128i v_extendedprice = _mm_and_si128(v_p0,
+        _mm_loadu_si128((const __m128i *)(l_extendedprice + i)));
+    __m128i v_product = _mm_mullo_epi32(v_extendedprice, v_discount);
+    v_sum = _mm_add_epi64(v_sum, _mm_cvtepi32_epi64(v_product));
+    v_sum = _mm_add_epi64(v_sum, _mm_cvtepi32_epi64(_mm_srli_si128(v_product, 8)));
   }
 
-  return result;
+  return q6_kernel_scalar(l_shipdate, l_discount, l_quantity, l_extendedprice, i, end) +
+    _mm_extract_epi64(v_sum, 0) + _mm_extract_epi64(v_sum, 1);
 }
 
+/** Sums the four 64-bit lanes of a vector. */
+TARGET_AVX2
+static inline decimal_sum_t hsum_epi64(__m256i v) {
+  __m128i v_sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  return _mm_extract_epi64(v_sum, 0) + _mm_extract_epi64(v_sum, 1);
+}
 
+/** Adds the eight 32-bit products in v_product to the four 64-bit lanes of
+ * v_sum. A single product fits 32 bits, but their sum does not.
+ */
+TARGET_AVX2
+static inline __m256i add_products_epi64(__m256i v_sum, __m256i v_product) {
+  v_sum = _mm256_add_epi64(v_sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v_product)));
+  return _mm256_add_epi64(v_sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v_product, 1)));
+}
 
-
-int q6_columnar_simd_compare_unaligned_loads(int *l_shipdate, int *l_discount,
-    int *l_quantity, int *l_extendedprice, size_t length, int tid) {
-  size_t i;
-  int result = 0;
+TARGET_AVX2
+decimal_sum_t q6_columnar_simd_compare_unaligned_loads(date_t *l_shipdate,
+    small_decimal_t *l_discount, uint8_t *l_quantity, decimal_t *l_extendedprice,
+    int start, int end) {
+  int i;
 
   // The vectors used for comparison.
   // We add (or subtract) the 1 since we're using a > rather than >= instruction
-  const __m256i v_shipdate_lower = _mm256_set1_epi32(19940101 - 1);
-  const __m256i v_shipdate_upper = _mm256_set1_epi32(19950101);
+  const __m256i v_shipdate_lower = _mm256_set1_epi32(SHIPDATE_LOW - 1);
+  const __m256i v_shipdate_upper = _mm256_set1_epi32(SHIPDATE_HIGH);
 
-  const __m256i v_discount_lower = _mm256_set1_epi32(5 - 1);
-  const __m256i v_discount_upper = _mm256_set1_epi32(7 + 1);
+  const __m256i v_discount_lower = _mm256_set1_epi32(DISCOUNT_LOW - 1);
+  const __m256i v_discount_upper = _mm256_set1_epi32(DISCOUNT_HIGH + 1);
 
-  const __m256i v_quantity_upper = _mm256_set1_epi32(24);
+  const __m256i v_quantity_upper = _mm256_set1_epi32(QUANTITY_HIGH);
 
-  __m256i v_sum = _mm256_set1_epi32(0);
-  __m128i v_high, v_low;
-
-  int start = (length / NUM_PARALLEL_THREADS) * tid;
-  int end = start + (length / NUM_PARALLEL_THREADS);
-
-  if (tid == NUM_PARALLEL_THREADS - 1) {
-    end = length;
-  }
+  __m256i v_sum = _mm256_set1_epi64x(0);
 
   for (i = start; i+8 <= end; i += 8) {
 
     __m256i v_shipdate, v_discount, v_quantity, v_extendedprice;
     __m256i v_p0;
 
-    v_shipdate = _mm256_lddqu_si256((const __m256i *)(l_shipdate + i));
-    v_discount = _mm256_lddqu_si256((const __m256i *)(l_discount + i));
-    v_quantity = _mm256_lddqu_si256((const __m256i *)(l_quantity + i));
+    // Widen the narrow columns to 32-bit lanes.
+    v_shipdate = _mm256_cvtepu16_epi32(_mm_lddqu_si128((const __m128i *)(l_shipdate + i)));
+    v_discount = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l_discount + i)));
+    v_quantity = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l_quantity + i)));
 
     // Take the bitwise AND of each comparison to create a bitmask, which will select the
     // rows that pass the predicate.
@@ -157,200 +170,246 @@ int q6_columnar_simd_compare_unaligned_loads(int *l_shipdate, int *l_discount,
     // Load the appropriate values from extendedprice. Since this instruction zeroes out
     // the unselected lanes, we don't need to reload discount again
     v_extendedprice = _mm256_maskload_epi32(l_extendedprice + i, v_p0);
-    v_sum = _mm256_add_epi32(_mm256_mullo_epi32(v_extendedprice, v_discount), v_sum);
+    v_sum = add_products_epi64(v_sum, _mm256_mullo_epi32(v_extendedprice, v_discount));
   }
 
   // Handle the fringe
-  for (; i < end; i++) {
-    result += ((l_shipdate[i] >= 19940101) &
-        (l_shipdate[i] < 19950101) &
-        (l_discount[i] >= 5) &
-        (l_discount[i] <= 7) &
-        (l_quantity[i] < 24)) * l_extendedprice[i] * l_discount[i];
-  }
-
-  // We can use three instructions here to collapse the eight values using a sum,
-  // into two 32-bit values. Then we extract those two values from the vector and
-  // add them into the final result.
-  v_sum = _mm256_hadd_epi32(v_sum, _mm256_set1_epi32(0));
-  v_high = _mm256_extracti128_si256(v_sum, 1);
-  v_low = _mm256_castsi256_si128(v_sum);
-  v_sum = _mm256_castsi128_si256(_mm_add_epi32(v_low, v_high));
-
-  result += _mm256_extract_epi32(v_sum, 0) + _mm256_extract_epi32(v_sum, 1);
-
-  return result;
+  return q6_kernel_scalar(l_shipdate, l_discount, l_quantity, l_extendedprice, i, end) +
+    hsum_epi64(v_sum);
 }
 
-int run_parallel(int *l_shipdate, int *l_discount,
-    int *l_quantity, int *l_extendedprice, size_t length) {
-
-  int final = 0;
-
-#pragma omp parallel for
-  for (int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-    int r = q6_columnar_simd_compare_unaligned_loads(l_shipdate, l_discount, l_quantity,
-        l_extendedprice, length, i);
-
-#pragma omp critical(merge)
-    {
-      final += r;
-    }
+TARGET_AVX512
+decimal_sum_t q6_kernel_avx512(date_t *l_shipdate, small_decimal_t *l_discount,
+    uint8_t *l_quantity, decimal_t *l_extendedprice, int start, int end) {
+  int i;
+
+  const __m512i v_shipdate_lower = _mm512_set1_epi32(SHIPDATE_LOW);
+  const __m512i v_shipdate_upper = _mm512_set1_epi32(SHIPDATE_HIGH);
+  const __m512i v_discount_lower = _mm512_set1_epi32(DISCOUNT_LOW);
+  const __m512i v_discount_upper = _mm512_set1_epi32(DISCOUNT_HIGH);
+  const __m512i v_quantity_upper = _mm512_set1_epi32(QUANTITY_HIGH);
+
+  __m512i v_sum = _mm512_setzero_si512();
+
+  for (i = start; i+16 <= end; i += 16) {
+    __m512i v_shipdate = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(l_shipdate + i)));
+    __m512i v_discount = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(l_discount + i)));
+    __m512i v_quantity = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(l_quantity + i)));
+
+    // Each compare is masked by the previous ones, so the predicate ends up
+    // in a single mask register.
+    __mmask16 m = _mm512_cmpge_epi32_mask(v_shipdate, v_shipdate_lower);
+    m = _mm512_mask_cmplt_epi32_mask(m, v_shipdate, v_shipdate_upper);
+    m = _mm512_mask_cmpge_epi32_mask(m, v_discount, v_discount_lower);
+    m = _mm512_mask_cmple_epi32_mask(m, v_discount, v_discount_upper);
+    m = _mm512_mask_cmplt_epi32_mask(m, v_quantity, v_quantity_upper);
+
+    // Only the selected prices are loaded; the others are zero.
+    __m512i v_extendedprice = _mm512_maskz_loadu_epi32(m, l_extendedprice + i);
+    __m512i v_product = _mm512_mullo_epi32(v_extendedprice, v_discount);
+    v_sum = _mm512_add_epi64(v_sum, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v_product)));
+    v_sum = _mm512_add_epi64(v_sum, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v_product, 1)));
   }
 
-  return final;
-
+  return q6_kernel_scalar(l_shipdate, l_discount, l_quantity, l_extendedprice, i, end) +
+    _mm512_reduce_add_epi64(v_sum);
 }
 
-int q6_columnar_simd_compare(int *l_shipdate,
-    int *l_discount,
-    int *l_quantity,
-    int *l_extendedprice,
-    size_t length) {
-
-  size_t i;
-  int result = 0;
-
-  // The vectors used for comparison.
-  // We add (or subtract) the 1 since we're using a > rather than >= instruction
-  const __m256i v_shipdate_lower = _mm256_set1_epi32(19940101 - 1);
-  const __m256i v_shipdate_upper = _mm256_set1_epi32(19950101);
-
-  const __m256i v_discount_lower = _mm256_set1_epi32(5 - 1);
-  const __m256i v_discount_upper = _mm256_set1_epi32(7 + 1);
-
-  const __m256i v_quantity_upper = _mm256_set1_epi32(24);
-
-  __m256i v_sum = _mm256_set1_epi32(0);
-  __m128i v_high, v_low;
+/** Returns the kernel for a SIMD level. */
+q6_kernel q6_kernel_for(SimdLevel level) {
+  switch (level) {
+    case SIMD_AVX512:
+      return q6_kernel_avx512;
+    case SIMD_AVX2:
+      return q6_columnar_simd_compare_unaligned_loads;
+    case SIMD_SSE4:
+      return q6_kernel_sse4;
+    default:
+      return q6_kernel_scalar;
+  }
+}
 
-  for (i = 0; i+8 <= length; i += 8) {
+// Runs the query with the given kernel over the rows whose shipdate zones
+// may match. Works on either the orderkey-sorted Lineitem or its
+// shipdate-sorted projection.
+template <typename Table>
+decimal_sum_t run_parallel(Table *l, size_t length, q6_kernel kernel) {
+  return morsel_reduce(length, (decimal_sum_t) 0,
+      [&](decimal_sum_t &r, int start, int end) {
+        l->shipdate_zones.scan(start, end, SHIPDATE_LOW, SHIPDATE_HIGH,
+            [&](int run_start, int run_end) {
+          r += kernel(l->shipdate, l->discount, l->quantity, l->extendedprice,
+              run_start, run_end);
+        });
+      },
+      [](decimal_sum_t &final, decimal_sum_t r) { final += r; });
+}
 
-    __m256i v_shipdate, v_discount, v_quantity, v_extendedprice;
-    __m256i v_p0, v_result;
-    __m128i v_high, v_low;
+// Runs the query with the template scan's kernel for a SIMD level.
+template <typename Table>
+decimal_sum_t run_scan(Table *l, size_t length, SimdLevel level) {
+  typename Q6Scan<Table>::Kernel kernel = Q6Scan<Table>::kernel_for(level);
+  return morsel_reduce(length, (decimal_sum_t) 0,
+      [&](decimal_sum_t &r, int start, int end) {
+        typename Q6Scan<Table>::State state = typename Q6Scan<Table>::State();
+        l->shipdate_zones.scan(start, end, SHIPDATE_LOW, SHIPDATE_HIGH,
+            [&](int run_start, int run_end) {
+          kernel(*l, run_start, run_end, state);
+        });
+        r += std::get<0>(state);
+      },
+      [](decimal_sum_t &final, decimal_sum_t r) { final += r; });
+}
 
-    // For some reason, dereferencing each element explicitly gives much better performance
-    // than using the unaligned load instructions.
-    v_shipdate = _mm256_set_epi32(l_shipdate[i+7], l_shipdate[i+6], l_shipdate[i+5],
-        l_shipdate[i+4], l_shipdate[i+3], l_shipdate[i+2], l_shipdate[i+1], l_shipdate[i]);
+// Runs the query on the vectorized pipeline.
+template <typename Table>
+decimal_sum_t run_pipeline(Table *l, size_t length) {
+  return morsel_reduce(length, (decimal_sum_t) 0,
+      [&](decimal_sum_t &r, int start, int end) {
+        l->shipdate_zones.scan(start, end, SHIPDATE_LOW, SHIPDATE_HIGH,
+            [&](int run_start, int run_end) {
+          pipeline_scan(run_start, run_end, [&](Selection &s) {
+            s.select_range(l->shipdate, SHIPDATE_LOW, SHIPDATE_HIGH);
+            s.select_range(l->quantity, 0, QUANTITY_HIGH);
+            s.select_range(l->discount, DISCOUNT_LOW, DISCOUNT_HIGH + 1);
+            r += s.sum([&](int i) { return (decimal_sum_t) l->extendedprice[i] * l->discount[i]; });
+          });
+        });
+      },
+      [](decimal_sum_t &final, decimal_sum_t r) { final += r; });
+}
 
-    v_discount = _mm256_set_epi32(l_discount[i+7], l_discount[i+6], l_discount[i+5],
-        l_discount[i+4], l_discount[i+3], l_discount[i+2], l_discount[i+1], l_discount[i]);
+// The Q6 conjuncts, for the adaptive filter.
+static const char* Q6_PREDICATES[] = {
+  "l_shipdate >= date '1994-01-01'",
+  "l_shipdate < date '1995-01-01'",
+  "l_discount >= 0.05",
+  "l_discount <= 0.07",
+  "l_quantity < 24",
+};
+
+// Runs the query with the adaptive filter rather than a fused kernel.
+template <typename Table, typename Filter>
+decimal_sum_t run_adaptive(Table *l, size_t length, const Filter& filter) {
+  return morsel_reduce(length, (decimal_sum_t) 0,
+      [&](decimal_sum_t &r, int start, int end) {
+        l->shipdate_zones.scan(start, end, SHIPDATE_LOW, SHIPDATE_HIGH,
+            [&](int run_start, int run_end) {
+          filter.run(run_start, run_end, [&](const int *sel, int n) {
+            for (int k = 0; k < n; k++) {
+              r += (decimal_sum_t) l->extendedprice[sel[k]] * l->discount[sel[k]];
+            }
+          });
+        });
+      },
+      [](decimal_sum_t &final, decimal_sum_t r) { final += r; });
+}
 
-    v_quantity = _mm256_set_epi32(l_quantity[i+7], l_quantity[i+6], l_quantity[i+5],
-        l_quantity[i+4], l_quantity[i+3], l_quantity[i+2], l_quantity[i+1], l_quantity[i]);
+int main(int argc, char **argv) {
+  if (!load_sf(argc, argv, SF)) {
+    printf("Run as ./q6 -sf <SF> [-nosnapshot]\n");
+    return 0;
+  }
 
-    // Take the bitwise AND of each comparison to create a bitmask, which will select the
-    // rows that pass the predicate.
-    v_p0 = _mm256_cmpgt_epi32(v_shipdate, v_shipdate_lower);
-    v_p0 = _mm256_and_si256(v_p0, _mm256_cmpgt_epi32(v_shipdate_upper, v_shipdate));
-    v_p0 = _mm256_and_si256(v_p0, _mm256_cmpgt_epi32(v_discount, v_discount_lower));
-    v_p0 = _mm256_and_si256(v_p0, _mm256_cmpgt_epi32(v_discount_upper, v_discount));
-    v_p0 = _mm256_and_si256(v_p0, _mm256_cmpgt_epi32(v_quantity_upper, v_quantity));
+  std::string data_dir = "../tpch/sf" + std::to_string(SF);
+  Lineitem *lineitems = new Lineitem(LINE_ITEM_PER_SF * SF);
+  num_lineitems = load_lineitem_table(lineitems, data_dir, SF);
+  assert(num_lineitems >= 0);
 
-    // Load the appropriate values from extendedprice. Since this instruction zeroes out
-    // the unselected lanes, we don't need to reload discount again
+  LineitemByShipdate *by_shipdate = build_shipdate_projection(lineitems, num_lineitems);
 
-    // The maskload seems slightly faster than loading all the extendedprice elements.
-    // May because there's so many extra instructions to get v_p0 into the right format?
-    v_extendedprice = _mm256_maskload_epi32(l_extendedprice + i, v_p0);
-    v_sum = _mm256_add_epi32(_mm256_mullo_epi32(v_extendedprice, v_discount), v_sum);
+  printf("Shipdate zones scanned: %d of %d, sorted by shipdate: %d of %d\n",
+      lineitems->shipdate_zones.matching(SHIPDATE_LOW, SHIPDATE_HIGH),
+      lineitems->shipdate_zones.num_zones,
+      by_shipdate->shipdate_zones.matching(SHIPDATE_LOW, SHIPDATE_HIGH),
+      by_shipdate->shipdate_zones.num_zones);
 
-    /*
-       v_extendedprice = _mm256_set_epi32(l_extendedprice[i+7], l_extendedprice[i+6], l_extendedprice[i+5],
-       l_extendedprice[i+4], l_extendedprice[i+3], l_extendedprice[i+2], l_extendedprice[i+1], l_extendedprice[i]);
+  SimdLevel level = detect_simd_level();
+  printf("SIMD level: %s\n", simd_level_name(level));
 
-       v_sum = _mm256_add_epi32(_mm256_mullo_epi32(
-       _mm256_and_si256(_mm256_set1_epi32(0x1), v_p0),
-       _mm256_mullo_epi32(v_extendedprice, v_discount)), v_sum);
-       */
+  struct timeval before, after, diff;
+  decimal_sum_t res;
+
+  // Every kernel this CPU can run, on the orderkey order.
+  for (int k = SIMD_SCALAR; k <= level; k++) {
+    q6_kernel kernel = q6_kernel_for((SimdLevel) k);
+    for (int i = 0;  i < 5; i ++) {
+      gettimeofday(&before, 0);
+      for (int i = 0; i < R; i++) {
+        res = run_parallel(lineitems, num_lineitems, kernel);
+      }
+      gettimeofday(&after, 0);
+      timersub(&after, &before, &diff);
+      printf("Q6 column %s: %ld.%06ld res=%s\n", simd_level_name((SimdLevel) k),
+          (long) diff.tv_sec, (long) diff.tv_usec, format_decimal(res, 4).c_str());
+    }
   }
 
-  // Handle the fringe
-  for (; i < length; i++) {
-    if (l_shipdate[i] >= 19940101 &&
-        l_shipdate[i] < 19950101 &&
-        l_discount[i] >= 5 &&
-        l_discount[i] <= 7 &&
-        l_quantity[i] < 24) {
-      result += l_extendedprice[i] * l_discount[i];
+  // The template scan, at every level.
+  for (int k = SIMD_SCALAR; k <= level; k++) {
+    for (int i = 0;  i < 5; i ++) {
+      gettimeofday(&before, 0);
+      for (int i = 0; i < R; i++) {
+        res = run_scan(lineitems, num_lineitems, (SimdLevel) k);
+      }
+      gettimeofday(&after, 0);
+      timersub(&after, &before, &diff);
+      printf("Q6 column scan %s: %ld.%06ld res=%s\n", simd_level_name((SimdLevel) k),
+          (long) diff.tv_sec, (long) diff.tv_usec, format_decimal(res, 4).c_str());
     }
   }
 
-  // We can use three instructions here to collapse the eight values using a sum,
-  // into two 32-bit values. Then we extract those two values from the vector and
-  // add them into the final result.
-  v_sum = _mm256_hadd_epi32(v_sum, _mm256_set1_epi32(0));
-  v_high = _mm256_extracti128_si256(v_sum, 1);
-  v_low = _mm256_castsi256_si128(v_sum);
-  v_sum = _mm256_castsi128_si256(_mm_add_epi32(v_low, v_high));
-
-  result += _mm256_extract_epi32(v_sum, 0) + _mm256_extract_epi32(v_sum, 1);
-
-  return result;
-}
-
-int q6_columnar_fewer_branches(int *l_shipdate, int *l_discount,
-    int *l_quantity, int *l_extendedprice, size_t length) {
-  int result = 0;
-  for (size_t i = 0; i < length; i++) {
-    if ((l_shipdate[i] >= 19940101) &
-        (l_shipdate[i] < 19950101) &
-        (l_discount[i] >= 5) &
-        (l_discount[i] <= 7) &
-        (l_quantity[i]) < 24) {
-      result += l_extendedprice[i] * l_discount[i];
+  for (int i = 0;  i < 5; i ++) {
+    gettimeofday(&before, 0);
+    for (int i = 0; i < R; i++) {
+      res = run_pipeline(lineitems, num_lineitems);
+    }
+    gettimeofday(&after, 0);
+    timersub(&after, &before, &diff);
+    printf("Q6 column pipeline: %ld.%06ld res=%s\n",
+        (long) diff.tv_sec, (long) diff.tv_usec, format_decimal(res, 4).c_str());
+  }
+  for (int i = 0;  i < 5; i ++) {
+    gettimeofday(&before, 0);
+    for (int i = 0; i < R; i++) {
+      res = run_pipeline(by_shipdate, num_lineitems);
     }
+    gettimeofday(&after, 0);
+    timersub(&after, &before, &diff);
+    printf("Q6 column pipeline sorted by shipdate: %ld.%06ld res=%s\n",
+        (long) diff.tv_sec, (long) diff.tv_usec, format_decimal(res, 4).c_str());
   }
-  return result;
-}
 
-int q6_columnar_no_branches(int *l_shipdate, int *l_discount,
-    int *l_quantity, int *l_extendedprice, size_t length) {
-
-  int result = 0;
-  for (size_t i = 0; i < length; i++) {
-    int passed = 0x1 & ((l_shipdate[i] >= 19940101) &
-        (l_shipdate[i] < 19950101) &
-        (l_discount[i] >= 5) &
-        (l_discount[i] <= 7) &
-        (l_quantity[i]) < 24);
-    result += (l_extendedprice[i] * l_discount[i] * passed);
+  FilterStats stats(Q6_PREDICATES, 5);
+  auto filter = make_filter(&stats,
+      [=](int i) { return lineitems->shipdate[i] >= SHIPDATE_LOW; },
+      [=](int i) { return lineitems->shipdate[i] < SHIPDATE_HIGH; },
+      [=](int i) { return lineitems->discount[i] >= DISCOUNT_LOW; },
+      [=](int i) { return lineitems->discount[i] <= DISCOUNT_HIGH; },
+      [=](int i) { return lineitems->quantity[i] < QUANTITY_HIGH; });
+  for (int i = 0;  i < 5; i ++) {
+    gettimeofday(&before, 0);
+    for (int i = 0; i < R; i++) {
+      res = run_adaptive(lineitems, num_lineitems, filter);
+    }
+    gettimeofday(&after, 0);
+    timersub(&after, &before, &diff);
+    printf("Q6 column adaptive: %ld.%06ld res=%s\n",
+        (long) diff.tv_sec, (long) diff.tv_usec, format_decimal(res, 4).c_str());
   }
-  return result;
-}
-
-int main(int argc, char **argv) {
-
-  FILE *tbl;
-  int count;
-
-  long lines = N;
-
-  fprintf(stderr, "Loading data from tpch-dbgen/lineitem.tbl...");
-  fflush(stderr);
-
-  tbl = fopen("../tpch/sf10/lineitem.tbl", "r");
-  count = loadData_q6(tbl, l_shipdate, l_discount, l_quantity, l_extendedprice, N, -1);
-  assert(count >= 0);
-  fclose(tbl);
-
-  fprintf(stderr, "loaded %d lines!\n", count);
-
-  struct timeval before, after, diff;
-  long res;
+  stats.print("Q6");
 
   for (int i = 0;  i < 5; i ++) {
     gettimeofday(&before, 0);
     for (int i = 0; i < R; i++) {
-      res = run_parallel(l_shipdate, l_discount,
-          l_quantity, l_extendedprice, count);
+      res = run_parallel(by_shipdate, num_lineitems, q6_kernel_for(level));
     }
     gettimeofday(&after, 0);
     timersub(&after, &before, &diff);
-    printf("Q6 column: %ld.%06ld res=%ld\n", (long) diff.tv_sec, (long) diff.tv_usec, res);
+    printf("Q6 column %s sorted by shipdate: %ld.%06ld res=%s\n", simd_level_name(level),
+        (long) diff.tv_sec, (long) diff.tv_usec, format_decimal(res, 4).c_str());
   }
+
+  delete lineitems;
   return 0;
 }
-
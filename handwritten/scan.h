@@ -0,0 +1,333 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <tuple>
+#include <stdint.h>
+
+#include "utils.h"
+
+/*
+ * Compile-time specialized scans
+ *
+ * A query kernel is written as a type: its columns, predicates and
+ * aggregates are descriptors, template parameters whose values and bounds
+ * are constants, e.g. Q6 is
+ *
+ *   Scan<All<Range<COLUMN(Lineitem, shipdate), SHIPDATE_LOW, SHIPDATE_HIGH>,
+ *            Range<COLUMN(Lineitem, discount), DISCOUNT_LOW, DISCOUNT_HIGH + 1>,
+ *            Range<COLUMN(Lineitem, quantity), 0, QUANTITY_HIGH> >,
+ *        SumProduct<COLUMN(Lineitem, extendedprice), COLUMN(Lineitem, discount)> >
+ *
+ * Every descriptor is a struct of static inline functions of (table, row),
+ * so the compiler inlines the whole query into one branch-free loop over
+ * the rows, which it vectorizes. Scan compiles that loop once per
+ * instruction set, with a TARGET_* attribute, and kernel_for picks one at run
+ * time, as for the handwritten kernels. GroupedScan does the same per group
+ * of a small key, e.g. the Q1 groups.
+ *
+ * Expressions (COLUMN, Const, OneMinus, OnePlus, Wide, Product, CompositeKey) have
+ * eval(table, i). Predicates (Range, Equal, InList, All) have test(table, i).
+ * Aggregates (Count, Sum, SumProduct) have an accumulator type Acc and
+ * add(acc, table, i, pass), which adds row i only if pass.
+ */
+
+/** Names the column name of Table, e.g. COLUMN(Lineitem, shipdate). */
+#define COLUMN(Table, name) Column<decltype(&Table::name), &Table::name>
+
+template <typename Member, Member member>
+struct Column;
+
+/** The i-th value of a column, a member T* of the table C. */
+template <typename C, typename T, T* C::*member>
+struct Column<T* C::*, member> {
+  typedef C Table;
+  typedef T Value;
+
+  static inline T eval(const C& t, int i) {
+    return (t.*member)[i];
+  }
+};
+
+template <typename Table, int value>
+struct Const {
+  static inline int eval(const Table&, int) {
+    return value;
+  }
+};
+
+/** 1 - e, for a decimal e scaled by DECIMAL_SCALE. */
+template <typename E>
+struct OneMinus {
+  typedef typename E::Table Table;
+
+  static inline int eval(const Table& t, int i) {
+    return DECIMAL_SCALE - E::eval(t, i);
+  }
+};
+
+/** 1 + e, for a decimal e scaled by DECIMAL_SCALE. */
+template <typename E>
+struct OnePlus {
+  typedef typename E::Table Table;
+
+  static inline int eval(const Table& t, int i) {
+    return DECIMAL_SCALE + E::eval(t, i);
+  }
+};
+
+/** e in 64 bits, for the products that do not fit 32. */
+template <typename E>
+struct Wide {
+  typedef typename E::Table Table;
+
+  static inline decimal_sum_t eval(const Table& t, int i) {
+    return E::eval(t, i);
+  }
+};
+
+/** The product of the expressions, in their promoted type as in C++: 32 bits
+ * unless one of them is Wide. The 32-bit multiplies vectorize on every
+ * instruction set, the 64-bit ones only with AVX-512DQ.
+ */
+template <typename E, typename... Es>
+struct Product {
+  typedef typename E::Table Table;
+
+  static inline auto eval(const Table& t, int i)
+      -> decltype(E::eval(t, i) * Product<Es...>::eval(t, i)) {
+    return E::eval(t, i) * Product<Es...>::eval(t, i);
+  }
+};
+
+template <typename E>
+struct Product<E> {
+  typedef typename E::Table Table;
+
+  static inline auto eval(const Table& t, int i) -> decltype(E::eval(t, i)) {
+    return E::eval(t, i);
+  }
+};
+
+/** Combines two group keys into one, hi * lo_values + lo, where lo is in
+ * [0, lo_values).
+ */
+template <typename Hi, typename Lo, int lo_values>
+struct CompositeKey {
+  typedef typename Hi::Table Table;
+
+  static inline int eval(const Table& t, int i) {
+    return Hi::eval(t, i) * lo_values + Lo::eval(t, i);
+  }
+};
+
+/** lo <= column < hi. Both bounds must fit the column's type, so the
+ * compares stay as narrow as the column (as in Selection::select_range).
+ */
+template <typename C, int lo, int hi>
+struct Range {
+  typedef typename C::Table Table;
+  typedef typename C::Value Value;
+
+  static inline bool test(const Table& t, int i) {
+    Value v = C::eval(t, i);
+    return (v >= (Value) lo) & (v < (Value) hi);
+  }
+};
+
+template <typename C, int value>
+struct Equal {
+  typedef typename C::Table Table;
+  typedef typename C::Value Value;
+
+  static inline bool test(const Table& t, int i) {
+    return C::eval(t, i) == (Value) value;
+  }
+};
+
+template <typename C, int value, int... values>
+struct InList {
+  typedef typename C::Table Table;
+
+  static inline bool test(const Table& t, int i) {
+    return Equal<C, value>::test(t, i) | InList<C, values...>::test(t, i);
+  }
+};
+
+template <typename C, int value>
+struct InList<C, value> : Equal<C, value> {};
+
+/** The conjunction of the predicates, evaluated without branches. */
+template <typename P, typename... Ps>
+struct All {
+  typedef typename P::Table Table;
+
+  static inline bool test(const Table& t, int i) {
+    return P::test(t, i) & All<Ps...>::test(t, i);
+  }
+};
+
+template <typename P>
+struct All<P> : P {};
+
+struct Count {
+  typedef int64_t Acc;
+
+  template <typename Table>
+  static inline void add(Acc& acc, const Table&, int, bool pass) {
+    acc += pass;
+  }
+};
+
+/** The sum of e over the passing rows, accumulated as an A. */
+template <typename E, typename A = decimal_sum_t>
+struct Sum {
+  typedef A Acc;
+
+  template <typename Table>
+  static inline void add(Acc& acc, const Table& t, int i, bool pass) {
+    // Evaluated on every row and multiplied by pass, rather than selected,
+    // so that the loop has no control flow and vectorizes.
+    acc += (Acc) (E::eval(t, i) * pass);
+  }
+};
+
+template <typename... Es>
+using SumProduct = Sum<Product<Es...> >;
+
+/** Adds row i to, or merges, the first n accumulators of a State, the tuple
+ * of the accumulators of the Aggregates tuple.
+ */
+template <size_t n, typename Aggregates>
+struct ScanAggregates {
+  typedef typename std::tuple_element<n - 1, Aggregates>::type Aggregate;
+
+  template <typename State, typename Table>
+  static inline void add(State& state, const Table& t, int i, bool pass) {
+    ScanAggregates<n - 1, Aggregates>::add(state, t, i, pass);
+    Aggregate::add(std::get<n - 1>(state), t, i, pass);
+  }
+
+  template <typename State>
+  static inline void merge(State& into, const State& state) {
+    ScanAggregates<n - 1, Aggregates>::merge(into, state);
+    std::get<n - 1>(into) += std::get<n - 1>(state);
+  }
+};
+
+template <typename Aggregates>
+struct ScanAggregates<0, Aggregates> {
+  template <typename State, typename Table>
+  static inline void add(State&, const Table&, int, bool) {}
+
+  template <typename State>
+  static inline void merge(State&, const State&) {}
+};
+
+/** Defines the kernels of a scan, each compiled for one instruction set from
+ * the same body, rows(t, start, end, state), and kernel_for.
+ */
+#define SCAN_KERNELS \
+  typedef void (*Kernel)(const Table& t, int start, int end, State& state); \
+  \
+  static void kernel_scalar(const Table& t, int start, int end, State& state) { \
+    rows(t, start, end, state); \
+  } \
+  TARGET_SSE4 \
+  static void kernel_sse4(const Table& t, int start, int end, State& state) { \
+    rows(t, start, end, state); \
+  } \
+  TARGET_AVX2 \
+  static void kernel_avx2(const Table& t, int start, int end, State& state) { \
+    rows(t, start, end, state); \
+  } \
+  TARGET_AVX512 \
+  static void kernel_avx512(const Table& t, int start, int end, State& state) { \
+    rows(t, start, end, state); \
+  } \
+  \
+  /** Returns the kernel for a SIMD level. */ \
+  static Kernel kernel_for(SimdLevel level) { \
+    switch (level) { \
+      case SIMD_AVX512: \
+        return kernel_avx512; \
+      case SIMD_AVX2: \
+        return kernel_avx2; \
+      case SIMD_SSE4: \
+        return kernel_sse4; \
+      default: \
+        return kernel_scalar; \
+    } \
+  } \
+  \
+  /** Adds the rows [start, end) of t to state, with the widest kernel the \
+   * CPU supports. \
+   */ \
+  static void run(const Table& t, int start, int end, State& state) { \
+    static const Kernel kernel = kernel_for(detect_simd_level()); \
+    kernel(t, start, end, state); \
+  }
+
+/** Aggregates the rows passing Where. A State, value-initialized to zeros,
+ * holds the accumulators of the Aggregates, in order.
+ */
+template <typename Where, typename... Aggregates>
+struct Scan {
+  typedef typename Where::Table Table;
+  typedef std::tuple<typename Aggregates::Acc...> State;
+  typedef ScanAggregates<sizeof...(Aggregates), std::tuple<Aggregates...> > Add;
+
+  __attribute__((always_inline))
+  static inline void rows(const Table& t, int start, int end, State& state) {
+    // A local copy keeps the accumulators in registers.
+    State s = state;
+    for (int i = start; i < end; i++) {
+      Add::add(s, t, i, Where::test(t, i));
+    }
+    state = s;
+  }
+
+  SCAN_KERNELS
+
+  static void merge(State& into, const State& state) {
+    Add::merge(into, state);
+  }
+};
+
+/** Aggregates the rows passing Where per group, where Key is in
+ * [0, num_groups).
+ */
+template <typename Key, int num_groups, typename Where, typename... Aggregates>
+struct GroupedScan {
+  typedef typename Where::Table Table;
+  typedef typename Scan<Where, Aggregates...>::State Group;
+  typedef typename Scan<Where, Aggregates...>::Add Add;
+
+  struct State {
+    Group groups[num_groups];
+  };
+
+  __attribute__((always_inline))
+  static inline void rows(const Table& t, int start, int end, State& state) {
+    // Adding to a group is a scatter, so the loop does not vectorize:
+    // branching on the predicate skips the failing rows instead.
+    State s = state;
+    for (int i = start; i < end; i++) {
+      if (Where::test(t, i)) {
+        Add::add(s.groups[Key::eval(t, i)], t, i, true);
+      }
+    }
+    state = s;
+  }
+
+  SCAN_KERNELS
+
+  static void merge(State& into, const State& state) {
+    for (int g = 0; g < num_groups; g++) {
+      Add::merge(into.groups[g], state.groups[g]);
+    }
+  }
+};
+
+#undef SCAN_KERNELS
+
+#endif
@@ -41,6 +41,7 @@ int main() {
     gettimeofday(&after, 0);
     timersub(&after, &before, &diff);
     printf("%ld.%06ld\n", (long) diff.tv_sec, (long) diff.tv_usec);
+    printf("%.2f GB/s\n", SIZE / (diff.tv_sec + diff.tv_usec / 1e6) / 1e9);
 
     printf("%ld\n", sum);
 }
@@ -0,0 +1,61 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+/** Keeps the k items ranking first by Less out of all items pushed, without
+ * materializing or sorting the rest.
+ *
+ * The kept items form a heap whose front ranks last among them, so most
+ * items are rejected with a single comparison against the front. For a
+ * parallel top-k, each thread pushes into its own TopK (e.g. as the state of
+ * morsel_reduce) and the heaps are merged at the end, which moves k items
+ * per thread rather than every candidate.
+ */
+template <typename T, typename Less = std::less<T> >
+struct TopK {
+  size_t k;
+  // Items pushed, kept or not.
+  long pushed;
+  std::vector<T> heap;
+  Less less;
+
+  explicit TopK(size_t k, Less less = Less()) : k(k), pushed(0), less(less) {
+    heap.reserve(k);
+  }
+
+  void push(const T& item) {
+    pushed++;
+    insert(item);
+  }
+
+  void merge(const TopK& other) {
+    pushed += other.pushed;
+    for (size_t i = 0; i < other.heap.size(); i++) {
+      insert(other.heap[i]);
+    }
+  }
+
+  /** Returns the kept items, first-ranking first. */
+  std::vector<T> sorted() const {
+    std::vector<T> items(heap);
+    std::sort_heap(items.begin(), items.end(), less);
+    return items;
+  }
+
+ private:
+  void insert(const T& item) {
+    if (heap.size() < k) {
+      heap.push_back(item);
+      std::push_heap(heap.begin(), heap.end(), less);
+    } else if (k > 0 && less(item, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), less);
+      heap.back() = item;
+      std::push_heap(heap.begin(), heap.end(), less);
+    }
+  }
+};
+
+#endif
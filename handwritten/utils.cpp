@@ -1,22 +1,56 @@
 #include <cstdlib>
 #include <string>
 #include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <map>
+#include <omp.h>
+#include <immintrin.h>
 
 #include "utils.h"
 
-#define BUF_SIZE 4096
+// Target size of a chunk handed to one parser thread.
+#define CHUNK_SIZE (4 << 20)
+
+bool use_snapshots = true;
 
 bool load_sf(int argc, char** argv, int& SF) {
+  bool found = false;
   for (int i=1; i<argc; i++) {
-    if (i+1 != argc) {
+    if (strcmp(argv[i], "-nosnapshot") == 0) {
+      use_snapshots = false;
+    } else if (i+1 != argc) {
       if (strcmp(argv[i], "-sf") == 0) {
         SF = atoi(argv[i+1]);
-        return true;
+        found = true;
       }
     }
   }
 
-  return false;
+  return found;
+}
+
+SimdLevel detect_simd_level() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return SIMD_SSE4;
+  }
+  return SIMD_SCALAR;
+}
+
+const char* simd_level_name(SimdLevel level) {
+  static const char* names[] = { "scalar", "SSE4", "AVX2", "AVX-512" };
+  return names[level];
 }
 
 int binary_search(int* arr, int len, int e) {
@@ -37,213 +71,1087 @@ int binary_search(int* arr, int len, int e) {
   return -1;
 }
 
-int parse_date(const char* d) {
+std::string format_decimal(wide_decimal_sum_t value, int scale_digits, int digits,
+    int64_t divisor) {
+  wide_decimal_sum_t num = value;
+  wide_decimal_sum_t den = divisor;
+  for (int i = 0; i < digits; i++) num *= 10;
+  for (int i = 0; i < scale_digits; i++) den *= 10;
+  if (den < 0) {
+    num = -num;
+    den = -den;
+  }
+
+  bool neg = num < 0;
+  if (neg) num = -num;
+  // The value scaled by 10^digits, rounded half away from zero.
+  wide_decimal_sum_t q = (num + den / 2) / den;
+
+  wide_decimal_sum_t unit = 1;
+  for (int i = 0; i < digits; i++) unit *= 10;
+  wide_decimal_sum_t whole = q / unit;
+  wide_decimal_sum_t frac = q % unit;
+
+  // Digits of the whole part, least significant first.
+  char buf[48];
+  int len = 0;
+  do {
+    buf[len++] = '0' + (int) (whole % 10);
+    whole /= 10;
+  } while (whole > 0);
+
+  std::string out = neg && q != 0 ? "-" : "";
+  while (len > 0) out += buf[--len];
+  if (digits > 0) {
+    out += '.';
+    for (int i = digits - 1; i >= 0; i--) {
+      wide_decimal_sum_t d = frac;
+      for (int j = 0; j < i; j++) d /= 10;
+      out += '0' + (int) (d % 10);
+    }
+  }
+  return out;
+}
+
+date_t parse_date(const char* d) {
   const char z = '0';
   int year = (d[3] - z) + (d[2] - z)*10 + (d[1]-z)*100 + (d[0]-z)*1000;
   int month = (d[6] - z) + (d[5] - z)*10;
   int day = (d[9] - z) + (d[8] - z)*10;
-  return day + month * 100 + year * 10000;
+  return make_date(year, month, day);
 }
 
-void load_orders(Order* orders, FILE* tbl, int partition, int num_parts, int sf) {
-  char buf[BUF_SIZE];
+std::string format_date(date_t d) {
+  // Room for any three ints, which is what the compiler checks against.
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%04d-%02d-%02d", date_year(d), date_month(d), date_day(d));
+  return buf;
+}
 
-  if (!tbl) {
-    perror("couldn't open orders file");
+/** A read-only memory mapping of a .tbl file. */
+struct MappedFile {
+  const char* data;
+  size_t size;
+};
+
+/** A newline-aligned range of a mapped file, and the rows it holds. */
+struct Chunk {
+  const char* start;
+  const char* end;
+  int rows;
+  int offset;
+};
+
+static bool map_file(const char* path, MappedFile* f) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
   }
 
-  int index = (partition * ORDERS_PER_SF * sf) / num_parts;
-  while (fgets(buf, BUF_SIZE, tbl)) {
-    char* line = buf;
-    char* token;
-    int column = 0;
-    while (column < 8 && (token = strsep(&line, "|")) != NULL) {
-      switch (column) {
-        case 0:
-          orders->orderkey[index] = atoi(token);
-          break;
-        case 1:
-          orders->custkey[index] = atoi(token);
-          break;
-        case 4:
-          orders->orderdate[index] = parse_date(token);
-          break;
-        case 5:
-          orders->orderpriority[index] = token[0] - '0';
-          break;
-        case 7:
-          orders->shippriority[index] = atoi(token);
-          break;
-        default:
-          break;
-      }
-      column++;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  f->size = st.st_size;
+  f->data = NULL;
+  if (f->size > 0) {
+    void* addr = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      return false;
     }
+    madvise(addr, f->size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    f->data = (const char*) addr;
+  }
+  close(fd);
+  return true;
+}
 
-    index++;
+static void unmap_file(MappedFile* f) {
+  if (f->data) {
+    munmap((void*) f->data, f->size);
   }
+  f->data = NULL;
+  f->size = 0;
 }
 
-int load_lineitems(Lineitem* lineitems, FILE* tbl, int offset) {
-  char buf[BUF_SIZE];
+/** Splits a mapped file into chunks of roughly CHUNK_SIZE bytes, each of
+ * which starts at the beginning of a line and ends just past a newline
+ * (or at the end of the file).
+ */
+static std::vector<Chunk> split_chunks(const MappedFile& f) {
+  std::vector<Chunk> chunks;
+  const char* p = f.data;
+  const char* file_end = f.data + f.size;
+  while (p < file_end) {
+    const char* end = p + CHUNK_SIZE;
+    if (end >= file_end) {
+      end = file_end;
+    } else {
+      const char* nl = (const char*) memchr(end, '\n', file_end - end);
+      end = nl ? nl + 1 : file_end;
+    }
+    Chunk c = { p, end, 0, 0 };
+    chunks.push_back(c);
+    p = end;
+  }
+  return chunks;
+}
 
-  if (!tbl) {
-    perror("couldn't open lineitems file");
+/*
+ * Delimiter scanning.
+ *
+ * Chunks are scanned in 32-byte blocks. Each block yields a bitmask of its
+ * '|' bytes and one of its '\n' bytes (with AVX2, two compares and two
+ * movemasks), and the set bits give the start of every field of a row
+ * without looking at the bytes in between.
+ *
+ * utils.cpp is not built for the host CPU, so the scanners are compiled once
+ * per instruction set, with a TARGET_* attribute, and picked at run time.
+ */
+
+// Upper bound on the number of fields recorded per row.
+#define MAX_FIELDS 24
+
+/** Sets the bitmasks of the '|' and '\n' bytes among the len (at most 32)
+ * bytes at p. Bit i corresponds to p[i].
+ */
+static inline void scan_block_scalar(const char* p, int len, uint32_t* pipes, uint32_t* newlines) {
+  uint32_t pm = 0, nm = 0;
+  for (int i = 0; i < len; i++) {
+    pm |= (uint32_t) (p[i] == '|') << i;
+    nm |= (uint32_t) (p[i] == '\n') << i;
+  }
+  *pipes = pm;
+  *newlines = nm;
+}
+
+TARGET_AVX2
+static inline void scan_block_avx2(const char* p, int len, uint32_t* pipes, uint32_t* newlines) {
+  char buf[32];
+  if (len < 32) {
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, p, len);
+    p = buf;
+  }
+  __m256i v = _mm256_loadu_si256((const __m256i*) p);
+  *pipes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+  *newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+}
+
+/** Defines count_rows_<suffix> and parse_rows_<suffix>, compiled with the
+ * attribute target and scanning blocks with scan_block.
+ */
+#define ROW_SCANNERS(suffix, target, scan_block) \
+  /** Counts the non-empty lines in a chunk. */ \
+  target \
+  static int count_rows_##suffix(const char* start, const char* end) { \
+    int rows = 0; \
+    /* Whether the byte before the current block ended a line. The chunk \
+     * start is always the start of a line. */ \
+    uint32_t carry = 1; \
+    for (const char* p = start; p < end; p += 32) { \
+      int len = end - p < 32 ? end - p : 32; \
+      uint32_t pipes, newlines; \
+      scan_block(p, len, &pipes, &newlines); \
+      /* A newline ends a row unless the byte before it was a newline too. */ \
+      uint32_t prev = (newlines << 1) | carry; \
+      rows += __builtin_popcount(newlines & ~prev); \
+      carry = newlines >> 31; \
+    } \
+    /* A final line without a trailing newline. */ \
+    if (end > start && end[-1] != '\n') rows++; \
+    return rows; \
+  } \
+  \
+  /** Calls parse_row(fields, index) for every non-empty line of a chunk, \
+   * where fields[i] is the start of the i'th field of the row. Field i ends \
+   * at fields[i+1] - 1. \
+   */ \
+  template <typename RowParser> \
+  target \
+  static void parse_rows_##suffix(const char* start, const char* end, int index, \
+      RowParser& parse_row) { \
+    const char* fields[MAX_FIELDS + 1]; \
+    int num_fields = 0; \
+    fields[0] = start; \
+    for (const char* p = start; p < end; p += 32) { \
+      int len = end - p < 32 ? end - p : 32; \
+      uint32_t pipes, newlines; \
+      scan_block(p, len, &pipes, &newlines); \
+      uint32_t delims = pipes | newlines; \
+      while (delims) { \
+        int bit = __builtin_ctz(delims); \
+        delims &= delims - 1; \
+        const char* q = p + bit; \
+        if ((newlines >> bit) & 1) { \
+          if (q > fields[0]) { \
+            parse_row(fields, index); \
+            index++; \
+          } \
+          num_fields = 0; \
+          fields[0] = q + 1; \
+        } else if (num_fields < MAX_FIELDS) { \
+          fields[++num_fields] = q + 1; \
+        } \
+      } \
+    } \
+    if (fields[0] < end) { \
+      parse_row(fields, index); \
+    } \
+  }
+
+ROW_SCANNERS(scalar, , scan_block_scalar)
+ROW_SCANNERS(avx2, TARGET_AVX2, scan_block_avx2)
+
+#undef ROW_SCANNERS
+
+static bool scan_with_avx2() {
+  static const bool avx2 = detect_simd_level() >= SIMD_AVX2;
+  return avx2;
+}
+
+static int count_rows(const char* start, const char* end) {
+  return scan_with_avx2() ? count_rows_avx2(start, end) : count_rows_scalar(start, end);
+}
+
+template <typename RowParser>
+static void parse_rows(const char* start, const char* end, int index, RowParser& parse_row) {
+  if (scan_with_avx2()) {
+    parse_rows_avx2(start, end, index, parse_row);
+  } else {
+    parse_rows_scalar(start, end, index, parse_row);
+  }
+}
+
+/** Parses every row of the files at paths in parallel, in order: the rows of
+ * paths[0] come first, then those of paths[1], and so on.
+ *
+ * Each file is split into newline-aligned chunks, and the chunks of all files
+ * are processed together. A first parallel pass counts the rows in each
+ * chunk, a prefix sum over those counts gives each chunk its exact first row
+ * index, and a second parallel pass calls parse_row(fields, index) for every
+ * line (see parse_rows).
+ *
+ * @return the number of rows parsed, or -1 if a file couldn't be mapped.
+ */
+template <typename RowParser>
+static int parse_tbl(const std::vector<std::string>& paths, int offset, RowParser parse_row) {
+  std::vector<MappedFile> files(paths.size());
+  std::vector<Chunk> chunks;
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!map_file(paths[i].c_str(), &files[i])) {
+      for (size_t j = 0; j < i; j++) {
+        unmap_file(&files[j]);
+      }
+      return -1;
+    }
+    std::vector<Chunk> file_chunks = split_chunks(files[i]);
+    chunks.insert(chunks.end(), file_chunks.begin(), file_chunks.end());
+  }
+  int num_chunks = chunks.size();
+
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < num_chunks; i++) {
+    chunks[i].rows = count_rows(chunks[i].start, chunks[i].end);
   }
 
   int index = offset;
-  while (fgets(buf, BUF_SIZE, tbl)) {
-    char* line = buf;
-    char* token;
-    int column = 0;
-    int commitdate, shipdate, recieptdate;
-    while ((token = strsep(&line, "|")) != NULL) {
-      switch (column) {
-        case 0:
-          lineitems->orderkey[index] = atoi(token);
-          break;
-        case 1:
-          lineitems->partkey[index] = atoi(token);
-          break;
-        case 4:
-          lineitems->quantity[index] = atoi(token);
-          break;
-        case 5:
-          lineitems->extendedprice[index] = atof(token);
-          break;
-        case 6:
-          lineitems->discount[index] = atof(token);
-          break;
-        case 7:
-          lineitems->tax[index] = atof(token);
-          break;
-        case 8:
-          if (token[0] == 'N') lineitems->returnflag[index] = 0;
-          else if (token[0] == 'R') lineitems->returnflag[index] = 1;
-          else lineitems->returnflag[index] = 2;
-          break;
-        case 9:
-          if (token[0] == 'O') lineitems->linestatus[index] = 0;
-          else lineitems->linestatus[index] = 1;
-          break;
-        case 10:
-          lineitems->shipdate[index] = parse_date(token);
-          break;
-        case 11:
-          lineitems->commitdate[index] = parse_date(token);
-          break;
-        case 12:
-          lineitems->recieptdate[index] = parse_date(token);
-          break;
-        case 13:
-          if(strcmp(token, "DELIVER IN PERSON") == 0) lineitems->shipinstruct[index] = 1;
-          else if(strcmp(token, "TAKE BACK RETURN") == 0) lineitems->shipinstruct[index] = 2;
-          else if(strcmp(token, "COLLECT COD") == 0) lineitems->shipinstruct[index] = 3;
-          else if(strcmp(token, "NONE") == 0) lineitems->shipinstruct[index] = 4;
-          else lineitems->shipinstruct[index] = 0;
-          break;
-        case 14:
-          if (strcmp(token, "MAIL") == 0) lineitems->shipmode[index] = 1;
-          else if (strcmp(token, "AIR") == 0) lineitems->shipmode[index] = 2;
-          else if (strcmp(token, "AIR REG") == 0) lineitems->shipmode[index] = 3;
-          else lineitems->shipmode[index] = 0;
-          break;
-        default:
-          break;
+  for (int i = 0; i < num_chunks; i++) {
+    chunks[i].offset = index;
+    index += chunks[i].rows;
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < num_chunks; i++) {
+    parse_rows(chunks[i].start, chunks[i].end, chunks[i].offset, parse_row);
+  }
+
+  for (size_t i = 0; i < files.size(); i++) {
+    unmap_file(&files[i]);
+  }
+  return index - offset;
+}
+
+/*
+ * Field decoders. These rely on the fixed formats dbgen writes and do no
+ * validation. All of them read only within the row being decoded.
+ */
+
+/** Returns the length of field i of a row. */
+static inline int field_length(const char* const* fields, int i) {
+  return fields[i + 1] - fields[i] - 1;
+}
+
+/** Decodes 1 to 8 ASCII digits with SWAR arithmetic. Reads 8 bytes at p. */
+static inline uint32_t decode_digits8(const char* p, int len) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  // Keep the digit values and shift out the bytes past the field, which
+  // leaves zeros as leading digits.
+  v = (v & 0x0F0F0F0F0F0F0F0FULL) << ((8 - len) * 8);
+  v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FFULL;
+  v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFFULL;
+  v = (v * 10000 + (v >> 32)) & 0xFFFFFFFFULL;
+  return v;
+}
+
+/** Decodes an unsigned integer of up to 16 digits. */
+static inline int64_t decode_uint(const char* p, int len) {
+  if (len <= 8) {
+    return decode_digits8(p, len);
+  }
+  return decode_digits8(p, len - 8) * 100000000LL + decode_digits8(p + len - 8, 8);
+}
+
+/** Decodes an unsigned decimal with exactly two fractional digits (e.g.
+ * 901.25) into an integer scaled by 100.
+ */
+static inline int64_t decode_decimal2(const char* p, int len) {
+  int64_t whole = decode_uint(p, len - 3);
+  return whole * 100 + (p[len - 2] - '0') * 10 + (p[len - 1] - '0');
+}
+
+/** Decodes a (possibly negative) integer. */
+static inline int decode_int(const char* p, int len) {
+  bool neg = *p == '-';
+  return neg ? -decode_uint(p + 1, len - 1) : decode_uint(p, len);
+}
+
+/** Returns true if the field of length len at p is exactly s. */
+static inline bool field_equals(const char* p, int len, const char* s) {
+  return strlen(s) == (size_t) len && memcmp(p, s, len) == 0;
+}
+
+/** Maps a fixed set of strings to codes with a perfect hash on their first
+ * two bytes and length, h = (p[0] + p[1] * m1 + len * m2) & mask, followed by
+ * one compare against the candidate. Strings outside the set map to 0.
+ */
+struct EnumDecoder {
+  const char* names[32];
+  int codes[32];
+  int m1;
+  int m2;
+  int mask;
+
+  EnumDecoder(const char* const* strs, const int* strcodes, int n,
+      int second_mult, int length_mult, int hash_mask) :
+    m1(second_mult), m2(length_mult), mask(hash_mask) {
+    memset(names, 0, sizeof(names));
+    memset(codes, 0, sizeof(codes));
+    for (int i = 0; i < n; i++) {
+      int h = hash(strs[i], strlen(strs[i]));
+      if (names[h]) {
+        fprintf(stderr, "EnumDecoder: %s collides with %s\n", strs[i], names[h]);
+        exit(1);
       }
-      column++;
+      names[h] = strs[i];
+      codes[h] = strcodes[i];
     }
-    index++;
   }
 
-  return index;
+  inline int hash(const char* p, int len) const {
+    return (p[0] + p[1] * m1 + len * m2) & mask;
+  }
+
+  inline int decode(const char* p, int len) const {
+    int h = hash(p, len);
+    return (names[h] && field_equals(p, len, names[h])) ? codes[h] : 0;
+  }
+};
+
+static const char* shipinstruct_names[] =
+  { "DELIVER IN PERSON", "TAKE BACK RETURN", "COLLECT COD", "NONE" };
+static const int shipinstruct_codes[] = { 1, 2, 3, 4 };
+static const EnumDecoder shipinstruct_decoder(
+    shipinstruct_names, shipinstruct_codes, 4, 0, 1, 7);
+
+static const char* shipmode_names[] = { "MAIL", "AIR", "AIR REG" };
+static const int shipmode_codes[] = { 1, 2, 3 };
+static const EnumDecoder shipmode_decoder(shipmode_names, shipmode_codes, 3, 0, 2, 15);
+
+static const char* container_type_names[] =
+  { "CASE", "DRUM", "PKG", "BAG", "CAN", "BOX", "PACK", "JAR" };
+static const int container_type_codes[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+static const EnumDecoder container_type_decoder(
+    container_type_names, container_type_codes, 8, 2, 5, 15);
+
+static const char* container_size_names[] = { "SM", "MED", "LG", "JUMBO", "WRAP" };
+static const int container_size_codes[] = { 10, 20, 30, 40, 50 };
+static const EnumDecoder container_size_decoder(
+    container_size_names, container_size_codes, 5, 0, 0, 7);
+
+int load_orders(Order* orders, const std::vector<std::string>& paths, int offset) {
+  int rows = parse_tbl(paths, offset, [orders](const char* const* f, int index) {
+    orders->orderkey[index] = decode_uint(f[O_ORDERKEY], field_length(f, O_ORDERKEY));
+    orders->custkey[index] = decode_uint(f[O_CUSTKEY], field_length(f, O_CUSTKEY));
+    orders->orderdate[index] = parse_date(f[O_ORDERDATE]);
+    orders->orderpriority[index] = f[O_ORDERPRIORITY][0] - '0';
+    orders->shippriority[index] = decode_uint(f[O_SHIPPRIORITY], field_length(f, O_SHIPPRIORITY));
+  });
+
+  if (rows < 0) {
+    perror("couldn't open orders file");
+    return offset;
+  }
+
+  return offset + rows;
 }
 
-void load_customers(Customer* c, FILE* tbl, int partition, int num_parts, int sf) {
-  char buf[BUF_SIZE];
+int load_lineitems(Lineitem* lineitems, const std::vector<std::string>& paths, int offset) {
+  int rows = parse_tbl(paths, offset, [lineitems](const char* const* f, int index) {
+    lineitems->orderkey[index] = decode_uint(f[L_ORDERKEY], field_length(f, L_ORDERKEY));
+    lineitems->partkey[index] = decode_uint(f[L_PARTKEY], field_length(f, L_PARTKEY));
+    lineitems->quantity[index] = decode_uint(f[L_QUANTITY], field_length(f, L_QUANTITY));
+    lineitems->extendedprice[index] =
+      decode_decimal2(f[L_EXTENDEDPRICE], field_length(f, L_EXTENDEDPRICE));
+    lineitems->discount[index] = decode_decimal2(f[L_DISCOUNT], field_length(f, L_DISCOUNT));
+    lineitems->tax[index] = decode_decimal2(f[L_TAX], field_length(f, L_TAX));
+
+    // N -> 0, R -> 1, anything else (A) -> 2.
+    char returnflag = f[L_RETURNFLAG][0];
+    lineitems->returnflag[index] = (returnflag != 'N') * (1 + (returnflag != 'R'));
+    // O -> 0, anything else (F) -> 1.
+    lineitems->linestatus[index] = f[L_LINESTATUS][0] != 'O';
+
+    lineitems->shipdate[index] = parse_date(f[L_SHIPDATE]);
+    lineitems->commitdate[index] = parse_date(f[L_COMMITDATE]);
+    lineitems->recieptdate[index] = parse_date(f[L_RECEIPTDATE]);
 
-  if (!tbl) {
+    lineitems->shipinstruct[index] =
+      shipinstruct_decoder.decode(f[L_SHIPINSTRUCT], field_length(f, L_SHIPINSTRUCT));
+    lineitems->shipmode[index] =
+      shipmode_decoder.decode(f[L_SHIPMODE], field_length(f, L_SHIPMODE));
+  });
+
+  if (rows < 0) {
+    perror("couldn't open lineitems file");
+    return offset;
+  }
+
+  return offset + rows;
+}
+
+int load_customers(Customer* c, const std::vector<std::string>& paths, int offset) {
+  int rows = parse_tbl(paths, offset, [c](const char* const* f, int index) {
+    c->custkey[index] = decode_uint(f[0], field_length(f, 0));
+    c->mktsegment[index] = field_equals(f[6], field_length(f, 6), "MACHINERY") ? 1 : 0;
+  });
+
+  if (rows < 0) {
     perror("couldn't open customers file");
+    return offset;
+  }
+
+  return offset + rows;
+}
+
+int load_parts(Part* parts, const std::vector<std::string>& paths, int offset) {
+  int rows = parse_tbl(paths, offset, [parts](const char* const* f, int index) {
+    parts->partkey[index] = decode_uint(f[0], field_length(f, 0));
+
+    // Brand#MN
+    parts->brand[index] = decode_uint(f[3] + 6, field_length(f, 3) - 6);
+
+    parts->promo_str[index] = strncmp(f[4], "PROMO", 5) == 0 ? 1 : 0;
+    parts->size[index] = decode_uint(f[5], field_length(f, 5));
+
+    // The container is "<size> <type>", e.g. "SM CASE".
+    const char* container = f[6];
+    int len = field_length(f, 6);
+    const char* space = (const char*) memchr(container, ' ', len);
+    int size_len = space ? space - container : len;
+    int type = 0;
+    if (space) {
+      type = container_type_decoder.decode(space + 1, len - size_len - 1);
+    }
+    int size = container_size_decoder.decode(container, size_len);
+    parts->container[index] = type + size;
+  });
+
+  if (rows < 0) {
+    perror("couldn't open parts file");
+    return offset;
+  }
+
+  return offset + rows;
+}
+
+/*
+ * Binary snapshots.
+ */
+
+/** A column of a table struct that is stored in the snapshot. */
+struct SnapshotColumn {
+  const char* name;
+  void** data;
+  size_t width;
+  // Frees the array the column currently points to.
+  void (*release)(void*);
+};
+
+typedef std::vector<SnapshotColumn> SnapshotColumns;
+
+template <typename T>
+static void release_column(void* column) {
+  free_column((T*) column);
+}
+
+template <typename T>
+static void add_column(SnapshotColumns& columns, const char* name, T*& data) {
+  SnapshotColumn c = { name, (void**) &data, sizeof(T), release_column<T> };
+  columns.push_back(c);
+}
+
+static SnapshotColumns snapshot_columns(Lineitem* l) {
+  SnapshotColumns columns;
+  add_column(columns, "orderkey", l->orderkey);
+  add_column(columns, "quantity", l->quantity);
+  add_column(columns, "partkey", l->partkey);
+  add_column(columns, "extendedprice", l->extendedprice);
+  add_column(columns, "discount", l->discount);
+  add_column(columns, "tax", l->tax);
+  add_column(columns, "commitdate", l->commitdate);
+  add_column(columns, "shipdate", l->shipdate);
+  add_column(columns, "recieptdate", l->recieptdate);
+  add_column(columns, "shipinstruct", l->shipinstruct);
+  add_column(columns, "shipmode", l->shipmode);
+  add_column(columns, "returnflag", l->returnflag);
+  add_column(columns, "linestatus", l->linestatus);
+  return columns;
+}
+
+static SnapshotColumns snapshot_columns(Order* o) {
+  SnapshotColumns columns;
+  add_column(columns, "orderkey", o->orderkey);
+  add_column(columns, "custkey", o->custkey);
+  add_column(columns, "orderdate", o->orderdate);
+  add_column(columns, "orderpriority", o->orderpriority);
+  add_column(columns, "shippriority", o->shippriority);
+  return columns;
+}
+
+static SnapshotColumns snapshot_columns(Part* p) {
+  SnapshotColumns columns;
+  add_column(columns, "partkey", p->partkey);
+  add_column(columns, "brand", p->brand);
+  add_column(columns, "size", p->size);
+  add_column(columns, "container", p->container);
+  add_column(columns, "promo_str", p->promo_str);
+  return columns;
+}
+
+static SnapshotColumns snapshot_columns(Customer* c) {
+  SnapshotColumns columns;
+  add_column(columns, "custkey", c->custkey);
+  add_column(columns, "mktsegment", c->mktsegment);
+  return columns;
+}
+
+// Columns currently mapped from snapshots, with their mapping length.
+static std::map<void*, size_t> mapped_columns;
+
+bool unmap_column(void* column) {
+  std::map<void*, size_t>::iterator it = mapped_columns.find(column);
+  if (it == mapped_columns.end()) {
+    return false;
+  }
+  munmap(it->first, it->second);
+  mapped_columns.erase(it);
+  return true;
+}
+
+static std::string snapshot_dir(const std::string& data_dir) {
+  return data_dir + "/snapshot";
+}
+
+static std::string header_path(const std::string& data_dir, const char* table) {
+  return snapshot_dir(data_dir) + "/" + table + ".hdr";
+}
+
+static std::string column_path(const std::string& data_dir, const char* table,
+    const char* column) {
+  return snapshot_dir(data_dir) + "/" + table + "." + column + ".bin";
+}
+
+/** Returns the size of the file at path, or -1 if it doesn't exist. */
+static int64_t file_size(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return -1;
+  }
+  return st.st_size;
+}
+
+/** Returns the total size of the files, or -1 if there are none. */
+static int64_t total_size(const std::vector<std::string>& paths) {
+  int64_t total = paths.empty() ? -1 : 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    total += file_size(paths[i]);
+  }
+  return total;
+}
+
+std::vector<std::string> table_files(const std::string& data_dir, const char* table) {
+  std::vector<std::string> paths;
+  std::string path = data_dir + "/" + table + ".tbl";
+  if (file_size(path) >= 0) {
+    paths.push_back(path);
+    return paths;
+  }
+  for (int part = 1; ; part++) {
+    std::string part_path = path + "." + std::to_string(part);
+    if (file_size(part_path) < 0) {
+      break;
+    }
+    paths.push_back(part_path);
+  }
+  return paths;
+}
+
+/** Maps the columns of a valid snapshot into the table, replacing the
+ * arrays allocated by its constructor. The snapshot must have between
+ * min_rows and capacity rows, and have been built from source_size bytes of
+ * .tbl files (unless that is -1).
+ *
+ * @return the number of rows, or -1 if there is no valid snapshot.
+ */
+static int map_snapshot(const std::string& data_dir, const char* table,
+    SnapshotColumns columns, int sf, int min_rows, int capacity, int64_t source_size) {
+  FILE* f = fopen(header_path(data_dir, table).c_str(), "rb");
+  if (!f) {
+    return -1;
+  }
+  SnapshotHeader h;
+  bool read = fread(&h, sizeof(h), 1, f) == 1;
+  fclose(f);
+
+  if (!read ||
+      h.magic != SNAPSHOT_MAGIC ||
+      h.version != SNAPSHOT_VERSION ||
+      h.encoding != SNAPSHOT_ENCODING ||
+      h.sf != sf ||
+      h.num_columns != (int32_t) columns.size() ||
+      h.rows < min_rows ||
+      h.rows > capacity ||
+      (source_size >= 0 && source_size != h.source_size)) {
+    return -1;
   }
 
-  int index = (partition * CUSTOMERS_PER_SF * sf) / num_parts;
-  int count = 0;
-  while (fgets(buf, BUF_SIZE, tbl)) {
-    char* line = buf;
-    char* token;
-    int column = 0;
-    while ((token = strsep(&line, "|")) != NULL) {
-      if (column == 6) {
-        if (strcmp(token, "MACHINERY") == 0) { count++; c->mktsegment[index] = 1; }
-        else c->mktsegment[index] = 0;
+  for (size_t i = 0; i < columns.size(); i++) {
+    std::string path = column_path(data_dir, table, columns[i].name);
+    if (file_size(path) != (int64_t) (h.rows * columns[i].width)) {
+      return -1;
+    }
+  }
+
+  std::vector<void*> mapped;
+  for (size_t i = 0; i < columns.size(); i++) {
+    std::string path = column_path(data_dir, table, columns[i].name);
+    size_t length = h.rows * columns[i].width;
+    void* addr = MAP_FAILED;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0 && length > 0) {
+      // Private and writable, so the queries can treat the column like any
+      // other array. Populated upfront to keep page faults out of the queries.
+      addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (addr == MAP_FAILED) {
+      for (size_t j = 0; j < mapped.size(); j++) {
+        munmap(mapped[j], h.rows * columns[j].width);
       }
-      column++;
+      return -1;
     }
-    index++;
+    mapped.push_back(addr);
+  }
+
+  for (size_t i = 0; i < columns.size(); i++) {
+    columns[i].release(*columns[i].data);
+    *columns[i].data = mapped[i];
+    mapped_columns[mapped[i]] = h.rows * columns[i].width;
   }
+
+  return h.rows;
 }
 
-void load_parts(Part* parts, FILE* tbl, int offset) {
-  char buf[BUF_SIZE];
+/** Writes a file atomically by writing to a temporary file and renaming. */
+static bool write_file(const std::string& path, const void* data, size_t length) {
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = length == 0 || fwrite(data, length, 1, f) == 1;
+  ok = (fclose(f) == 0) && ok;
+  if (ok) {
+    ok = rename(tmp.c_str(), path.c_str()) == 0;
+  } else {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
 
-  if (!tbl) {
-    perror("couldn't open parts file");
+/** Writes the first rows of the table's columns as a snapshot. The header
+ * is written last, so an interrupted write never leaves a valid snapshot.
+ */
+static void save_snapshot(const std::string& data_dir, const char* table,
+    SnapshotColumns columns, int sf, int rows, int64_t source_size) {
+  std::string dir = snapshot_dir(data_dir);
+  mkdir(dir.c_str(), 0755);
+
+  // Invalidate any previous snapshot before overwriting its columns.
+  unlink(header_path(data_dir, table).c_str());
+
+  for (size_t i = 0; i < columns.size(); i++) {
+    std::string path = column_path(data_dir, table, columns[i].name);
+    if (!write_file(path, *columns[i].data, (size_t) rows * columns[i].width)) {
+      perror("couldn't write snapshot column");
+      return;
+    }
   }
 
-  int index = offset;
-  while (fgets(buf, BUF_SIZE, tbl)) {
-    char* line = buf;
-    char* token;
-    int column = 0;
-    while ((token = strsep(&line, "|")) != NULL) {
-      switch (column) {
-        case 0:
-          parts->partkey[index] = atoi(token);
-          break;
-        case 3:
-          int brand;
-          sscanf(token, "Brand#%d", &brand);
-          parts->brand[index] = brand;
-          break;
-        case 4:
-          int promostr;
-          if (strncmp(token, "PROMO", 5) == 0) {
-              promostr = 1;
-          } else {
-              promostr = 0;
+  SnapshotHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = SNAPSHOT_MAGIC;
+  h.version = SNAPSHOT_VERSION;
+  h.encoding = SNAPSHOT_ENCODING;
+  h.rows = rows;
+  h.sf = sf;
+  h.num_columns = columns.size();
+  h.source_size = source_size;
+  if (!write_file(header_path(data_dir, table), &h, sizeof(h))) {
+    perror("couldn't write snapshot header");
+  }
+}
+
+/** Loads a table from its snapshot if possible, otherwise by calling
+ * load_tbl(paths) on its .tbl files and then snapshotting the loaded columns.
+ */
+template <typename Table, typename Loader>
+static int load_table(Table* t, const std::string& data_dir, const char* table,
+    int sf, int capacity, Loader load_tbl) {
+  SnapshotColumns columns = snapshot_columns(t);
+  int64_t source_size = total_size(table_files(data_dir, table));
+  if (use_snapshots) {
+    int rows = map_snapshot(data_dir, table, columns, sf, 0, capacity, source_size);
+    if (rows >= 0) {
+      printf("Loaded %d rows of %s from snapshot\n", rows, table);
+      return rows;
+    }
+  }
+
+  std::vector<std::string> paths = table_files(data_dir, table);
+  if (paths.empty()) {
+    fprintf(stderr, "couldn't find %s/%s.tbl or %s.tbl.1\n", data_dir.c_str(), table, table);
+    return 0;
+  }
+
+  struct timeval before, after, diff;
+  gettimeofday(&before, 0);
+  int rows = load_tbl(paths);
+  gettimeofday(&after, 0);
+  timersub(&after, &before, &diff);
+
+  // Parse throughput, comparable to the memory bandwidth reported by stream.
+  double secs = diff.tv_sec + diff.tv_usec / 1e6;
+  double gbs = secs > 0 ? total_size(paths) / secs / 1e9 : 0;
+  printf("Loaded %d rows of %s from %s (%d file%s): %ld.%06ld (%.2f GB/s)\n", rows, table,
+      paths[0].c_str(), (int) paths.size(), paths.size() == 1 ? "" : "s",
+      (long) diff.tv_sec, (long) diff.tv_usec, gbs);
+
+  if (use_snapshots && rows > 0) {
+    save_snapshot(data_dir, table, columns, sf, rows, source_size);
+  }
+  return rows;
+}
+
+int load_lineitem_table(Lineitem* lineitems, const std::string& data_dir, int sf) {
+  int rows = load_table(lineitems, data_dir, "lineitem", sf, LINE_ITEM_PER_SF * sf,
+      [lineitems](const std::vector<std::string>& paths) {
+        return load_lineitems(lineitems, paths, 0);
+      });
+  lineitems->shipdate_zones.build(lineitems->shipdate, rows);
+  lineitems->recieptdate_zones.build(lineitems->recieptdate, rows);
+  return rows;
+}
+
+LineitemByShipdate* build_shipdate_projection(Lineitem* lineitems, int rows) {
+  struct timeval before, after, diff;
+  gettimeofday(&before, 0);
+
+  delete lineitems->by_shipdate;
+  LineitemByShipdate* p = new LineitemByShipdate(rows);
+  const date_t* shipdate = lineitems->shipdate;
+
+  date_t lo = 0xFFFF, hi = 0;
+#pragma omp parallel for reduction(min:lo) reduction(max:hi)
+  for (int i = 0; i < rows; i++) {
+    lo = shipdate[i] < lo ? shipdate[i] : lo;
+    hi = shipdate[i] > hi ? shipdate[i] : hi;
+  }
+  int range = rows > 0 ? hi - lo + 1 : 1;
+
+  // Counting sort: each thread counts the dates of its slice of rows, the
+  // prefix sum over (date, thread) gives each thread its output positions
+  // per date, and each thread scatters its slice. Scattering slices in
+  // order keeps the sort stable.
+  std::vector<int> counts((size_t) omp_get_max_threads() * range);
+  int num_threads = 1;
+#pragma omp parallel
+  {
+#pragma omp single
+    num_threads = omp_get_num_threads();
+
+    int t = omp_get_thread_num();
+    int start = (int) ((int64_t) rows * t / num_threads);
+    int end = (int) ((int64_t) rows * (t + 1) / num_threads);
+    int* count = &counts[(size_t) t * range];
+    for (int i = start; i < end; i++) {
+      count[shipdate[i] - lo]++;
+    }
+
+#pragma omp barrier
+#pragma omp single
+    {
+      int offset = 0;
+      for (int d = 0; d < range; d++) {
+        for (int u = 0; u < num_threads; u++) {
+          int c = counts[(size_t) u * range + d];
+          counts[(size_t) u * range + d] = offset;
+          offset += c;
+        }
+      }
+    }
+
+    for (int i = start; i < end; i++) {
+      p->rowid[count[shipdate[i] - lo]++] = i;
+    }
+  }
+
+#pragma omp parallel for
+  for (int j = 0; j < rows; j++) {
+    int i = p->rowid[j];
+    p->shipdate[j] = shipdate[i];
+    p->quantity[j] = lineitems->quantity[i];
+    p->partkey[j] = lineitems->partkey[i];
+    p->extendedprice[j] = lineitems->extendedprice[i];
+    p->discount[j] = lineitems->discount[i];
+    p->tax[j] = lineitems->tax[i];
+    p->returnflag[j] = lineitems->returnflag[i];
+    p->linestatus[j] = lineitems->linestatus[i];
+  }
+  p->shipdate_zones.build(p->shipdate, rows);
+  lineitems->by_shipdate = p;
+
+  gettimeofday(&after, 0);
+  timersub(&after, &before, &diff);
+
+  size_t lineitem_bytes = 0;
+  SnapshotColumns columns = snapshot_columns(lineitems);
+  for (size_t c = 0; c < columns.size(); c++) {
+    lineitem_bytes += columns[c].width * rows;
+  }
+  printf("Built shipdate projection of %d rows: %ld.%06ld, %.1f MB (+%.0f%% over lineitem)\n",
+      rows, (long) diff.tv_sec, (long) diff.tv_usec, p->bytes() / 1e6,
+      lineitem_bytes > 0 ? 100.0 * p->bytes() / lineitem_bytes : 0.0);
+  return p;
+}
+
+int load_order_table(Order* orders, const std::string& data_dir, int sf) {
+  return load_table(orders, data_dir, "orders", sf, ORDERS_PER_SF * sf,
+      [orders](const std::vector<std::string>& paths) {
+        return load_orders(orders, paths, 0);
+      });
+}
+
+int load_part_table(Part* parts, const std::string& data_dir, int sf) {
+  return load_table(parts, data_dir, "part", sf, PARTS_PER_SF * sf,
+      [parts](const std::vector<std::string>& paths) {
+        return load_parts(parts, paths, 0);
+      });
+}
+
+int load_customer_table(Customer* customers, const std::string& data_dir, int sf) {
+  return load_table(customers, data_dir, "customer", sf, CUSTOMERS_PER_SF * sf,
+      [customers](const std::vector<std::string>& paths) {
+        return load_customers(customers, paths, 0);
+      });
+}
+
+/*
+ * Join indexes.
+ */
+
+/** Returns how many elements of a are among the first diag elements of the
+ * merge of the sorted arrays a and b, in which an element of b goes before
+ * an equal element of a.
+ */
+static int merge_path_split(const int* a, int n, const int* b, int m, int diag) {
+  int lo = diag > m ? diag - m : 0;
+  int hi = diag < n ? diag : n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (a[mid] < b[diag - mid - 1]) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/** A set of join index columns of equal length, snapshotted as one table. */
+struct JoinIndexColumns {
+  const char* name;
+  SnapshotColumns columns;
+  int rows;
+};
+
+/** Maps the join indexes from their snapshots if they are all valid for
+ * source_size, and otherwise calls build() and snapshots them.
+ */
+template <typename Build>
+static void load_join_indexes(const std::string& data_dir, int sf, int64_t source_size,
+    std::vector<JoinIndexColumns> indexes, Build build) {
+  bool mapped = use_snapshots;
+  for (size_t k = 0; mapped && k < indexes.size(); k++) {
+    JoinIndexColumns& index = indexes[k];
+    mapped = index.rows > 0 && map_snapshot(data_dir, index.name, index.columns, sf,
+        index.rows, index.rows, source_size) == index.rows;
+  }
+
+  std::string names;
+  for (size_t k = 0; k < indexes.size(); k++) {
+    names += (k > 0 ? ", " : "") + std::string(indexes[k].name);
+  }
+  if (mapped) {
+    printf("Loaded join indexes %s from snapshot\n", names.c_str());
+    return;
+  }
+
+  struct timeval before, after, diff;
+  gettimeofday(&before, 0);
+  build();
+  gettimeofday(&after, 0);
+  timersub(&after, &before, &diff);
+  printf("Built join indexes %s: %ld.%06ld\n", names.c_str(),
+      (long) diff.tv_sec, (long) diff.tv_usec);
+
+  for (size_t k = 0; use_snapshots && k < indexes.size(); k++) {
+    JoinIndexColumns& index = indexes[k];
+    if (index.rows > 0) {
+      save_snapshot(data_dir, index.name, index.columns, sf, index.rows, source_size);
+    }
+  }
+}
+
+/** Returns the total size of the .tbl files of two tables, or -1 if either
+ * has none.
+ */
+static int64_t total_size(const std::string& data_dir, const char* table1, const char* table2) {
+  int64_t size1 = total_size(table_files(data_dir, table1));
+  int64_t size2 = total_size(table_files(data_dir, table2));
+  return size1 >= 0 && size2 >= 0 ? size1 + size2 : -1;
+}
+
+void build_order_join_indexes(Lineitem* lineitems, int lineitem_rows,
+    Order* orders, int order_rows, const std::string& data_dir, int sf) {
+  std::vector<JoinIndexColumns> indexes(2);
+  indexes[0].name = "lineitem_orderindex";
+  indexes[0].rows = lineitem_rows;
+  add_column(indexes[0].columns, "orderindex", lineitems->orderindex);
+  indexes[1].name = "orders_lineitems";
+  indexes[1].rows = order_rows;
+  add_column(indexes[1].columns, "li_start", orders->li_start);
+  add_column(indexes[1].columns, "li_end", orders->li_end);
+
+  load_join_indexes(data_dir, sf, total_size(data_dir, "lineitem", "orders"), indexes, [&]() {
+    const int* a = lineitems->orderkey;
+    const int* b = orders->orderkey;
+    int n = lineitem_rows;
+    int m = order_rows;
+
+    // Merge path: split the merge of the two orderkey columns into equal
+    // runs of merge steps, so every morsel does the same work however the
+    // lineitems are spread over the orders. An order is merged before its
+    // lineitems, so when a lineitem is merged the last order was its own,
+    // unless its orderkey is not in orders.
+    morsel_for(n + m, [&](int d_start, int d_end) {
+      int i = merge_path_split(a, n, b, m, d_start);
+      int j = d_start - i;
+      for (int d = d_start; d < d_end; d++) {
+        if (i < n && (j >= m || a[i] < b[j])) {
+          if (j == 0 || b[j - 1] != a[i]) {
+            fprintf(stderr, "Join index: key %d is not in orders\n", a[i]);
+            exit(1);
           }
-          parts->promo_str[index] = promostr;
-        case 5:
-          parts->size[index] = atoi(token);
-          break;
-        case 6:
-          char case_type[10];
-          char case_size[10];
-          int type;
-          int size;
-          sscanf(token, "%s %s", case_size, case_type);
-          if(strcmp(case_type, "CASE") == 0) type = 1;
-          else if(strcmp(case_type, "DRUM") == 0) type = 2;
-          else if(strcmp(case_type, "PKG") == 0) type = 3;
-          else if(strcmp(case_type, "BAG") == 0) type = 4;
-          else if(strcmp(case_type, "CAN") == 0) type = 5;
-          else if(strcmp(case_type, "BOX") == 0) type = 6;
-          else if(strcmp(case_type, "PACK") == 0) type = 7;
-          else if(strcmp(case_type, "JAR") == 0) type = 8;
-          else type = 0;
-          if(strcmp(case_size, "SM") == 0) size = 10;
-          else if(strcmp(case_size, "MED") == 0) size = 20;
-          else if(strcmp(case_size, "LG") == 0) size = 30;
-          else if(strcmp(case_size, "JUMBO") == 0) size = 40;
-          else if(strcmp(case_size, "WRAP") == 0) size = 50;
-          else size = 0;
-          parts->container[index] = type + size;
-          break;
-        default:
-          break;
+          lineitems->orderindex[i++] = j - 1;
+        } else {
+          orders->li_start[j++] = i;
+        }
+      }
+    });
+
+    morsel_for(m, [&](int start, int end) {
+      for (int j = start; j < end; j++) {
+        orders->li_end[j] = j + 1 < m ? orders->li_start[j + 1] : n;
       }
-      column++;
+    });
+  });
+}
+
+/** Returns the row of key among the sorted keys[0, rows). dbgen writes the
+ * keys in order from 1, so this is usually key - keys[0]; otherwise the keys
+ * are searched. Exits if the key is missing, rather than returning a row the
+ * queries would dereference.
+ */
+static int key_row(const int* keys, int rows, int key, const char* table) {
+  int first = rows > 0 ? keys[0] : 0;
+  int row = key - first;
+  if (row < 0 || row >= rows || keys[row] != key) {
+    row = binary_search((int*) keys, rows, key);
+    if (row < 0) {
+      fprintf(stderr, "Join index: key %d is not in %s\n", key, table);
+      exit(1);
     }
-    index++;
   }
+  return row;
+}
+
+void build_part_join_index(Lineitem* lineitems, int lineitem_rows,
+    Part* parts, int part_rows, const std::string& data_dir, int sf) {
+  std::vector<JoinIndexColumns> indexes(1);
+  indexes[0].name = "lineitem_partindex";
+  indexes[0].rows = lineitem_rows;
+  add_column(indexes[0].columns, "partindex", lineitems->partindex);
+
+  load_join_indexes(data_dir, sf, total_size(data_dir, "lineitem", "part"), indexes, [&]() {
+    morsel_for(lineitem_rows, [&](int start, int end) {
+      for (int i = start; i < end; i++) {
+        lineitems->partindex[i] = key_row(parts->partkey, part_rows, lineitems->partkey[i], "part");
+      }
+    });
+  });
+}
+
+void build_customer_join_index(Order* orders, int order_rows,
+    Customer* customers, int customer_rows, const std::string& data_dir, int sf) {
+  std::vector<JoinIndexColumns> indexes(1);
+  indexes[0].name = "orders_custindex";
+  indexes[0].rows = order_rows;
+  add_column(indexes[0].columns, "custindex", orders->custindex);
+
+  load_join_indexes(data_dir, sf, total_size(data_dir, "orders", "customer"), indexes, [&]() {
+    morsel_for(order_rows, [&](int start, int end) {
+      for (int j = start; j < end; j++) {
+        orders->custindex[j] = key_row(customers->custkey, customer_rows, orders->custkey[j],
+            "customer");
+      }
+    });
+  });
 }
@@ -1,4 +1,12 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <atomic>
 #include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <omp.h>
 
 #define CUSTOMERS_PER_SF 150000
 #define ORDERS_PER_SF 1500000
@@ -36,63 +44,504 @@ typedef enum {
   O_COMMENT,
 } OrderKeyItens;
 
-// Sorted by orderkey.
+/*
+ * Fixed-point decimals.
+ *
+ * TPC-H decimals have two fractional digits, so they are stored as integers
+ * scaled by DECIMAL_SCALE: prices in cents, discount and tax in hundredths.
+ * A product carries the scale of each of its factors, e.g.
+ * extendedprice * (100 - discount) is scaled by 10^4, and
+ * extendedprice * (100 - discount) * (100 + tax) by 10^6.
+ */
+#define DECIMAL_SCALE 100
+
+// A decimal scaled by DECIMAL_SCALE.
+typedef int32_t decimal_t;
+
+// A decimal scaled by DECIMAL_SCALE that is below 2.56, i.e. discount and tax.
+typedef uint8_t small_decimal_t;
+
+// Sums of decimals, and of products of two decimals.
+typedef int64_t decimal_sum_t;
+
+// Sums of products of three decimals, which overflow 64 bits at large
+// scale factors.
+typedef __int128 wide_decimal_sum_t;
+
+/** Formats a fixed-point value, optionally divided by an integer, rounding
+ * half away from zero.
+ *
+ * @param value the value, scaled by 10^scale_digits
+ * @param scale_digits number of fractional digits in value
+ * @param digits number of fractional digits to print
+ * @param divisor value is divided by this before formatting (for averages
+ * and ratios)
+ *
+ * @return the formatted number, e.g. "1234.57"
+ */
+std::string format_decimal(wide_decimal_sum_t value, int scale_digits, int digits = 2,
+    int64_t divisor = 1);
+
+/** Unmaps a column that was mapped from a snapshot.
+ *
+ * @param column the column array
+ *
+ * @return true if the column was mapped (and is now unmapped), false if it
+ * was not mapped from a snapshot.
+ */
+bool unmap_column(void* column);
+
+/** Releases a column array owned by one of the table structs below, which
+ * either came from the struct's constructor or from a snapshot mapping.
+ */
+template <typename T>
+void free_column(T* column) {
+  if (!unmap_column(column)) {
+    delete[] column;
+  }
+}
+
+/*
+ * Dates.
+ *
+ * Dates are stored as date_t, the number of days since 1992-01-01 (the
+ * earliest date in TPC-H), which fits every TPC-H date in 16 bits and makes
+ * date arithmetic plain integer arithmetic. The calendar helpers below are
+ * constexpr, so query constants such as
+ * date_add_days(make_date(1998, 12, 1), -90) are folded at compile time.
+ */
+typedef uint16_t date_t;
+
+#define DATE_EPOCH_YEAR 1992
+
+// Days from 0000-03-01 to y-m-d in the proleptic Gregorian calendar. Years
+// are counted from March so that the leap day is the last day of the year.
+constexpr int civil_days_of_era(int yoe, int doy) {
+  return yoe * 365 + yoe / 4 - yoe / 100 + doy;
+}
+
+constexpr int civil_days_shifted(int y, int m, int d) {
+  return (y / 400) * 146097 +
+    civil_days_of_era(y % 400, (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1);
+}
+
+constexpr int civil_days(int y, int m, int d) {
+  return civil_days_shifted(m <= 2 ? y - 1 : y, m, d);
+}
+
+#define DATE_EPOCH_CIVIL_DAYS civil_days(DATE_EPOCH_YEAR, 1, 1)
+
+/** Returns the date_t of a calendar date, which must not be before
+ * 1992-01-01 or after 2171-06-06.
+ */
+constexpr date_t make_date(int year, int month, int day) {
+  return civil_days(year, month, day) - DATE_EPOCH_CIVIL_DAYS;
+}
+
+// The inverse of civil_days, split into single-expression steps.
+constexpr int date_day_of_era(date_t d) {
+  return (d + DATE_EPOCH_CIVIL_DAYS) % 146097;
+}
+
+constexpr int date_year_of_era(int doe) {
+  return (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+}
+
+constexpr int date_day_of_shifted_year(int doe) {
+  return doe - civil_days_of_era(date_year_of_era(doe), 0);
+}
+
+constexpr int date_shifted_month(int doe) {
+  return (5 * date_day_of_shifted_year(doe) + 2) / 153;
+}
+
+/** Returns the day of month (1-31) of a date. */
+constexpr int date_day(date_t d) {
+  return date_day_of_shifted_year(date_day_of_era(d)) -
+    (153 * date_shifted_month(date_day_of_era(d)) + 2) / 5 + 1;
+}
+
+/** Returns the month (1-12) of a date. */
+constexpr int date_month(date_t d) {
+  return date_shifted_month(date_day_of_era(d)) < 10 ?
+    date_shifted_month(date_day_of_era(d)) + 3 :
+    date_shifted_month(date_day_of_era(d)) - 9;
+}
+
+/** Returns the year of a date. */
+constexpr int date_year(date_t d) {
+  return (d + DATE_EPOCH_CIVIL_DAYS) / 146097 * 400 +
+    date_year_of_era(date_day_of_era(d)) + (date_month(d) <= 2);
+}
+
+constexpr bool is_leap_year(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+constexpr int days_in_month(int year, int month) {
+  return month == 2 ? 28 + is_leap_year(year) : 30 + ((month + (month > 7)) & 1);
+}
+
+/** date + interval 'n' day. */
+constexpr date_t date_add_days(date_t d, int n) {
+  return d + n;
+}
+
+// Builds the date of month index (year * 12 + month - 1), clamping day to
+// the length of that month.
+constexpr date_t make_date_clamped(int month_index, int day) {
+  return make_date(month_index / 12, month_index % 12 + 1,
+      day < days_in_month(month_index / 12, month_index % 12 + 1) ?
+        day : days_in_month(month_index / 12, month_index % 12 + 1));
+}
+
+/** date + interval 'n' month. As in SQL, a day past the end of the
+ * resulting month is clamped to its last day (e.g. 1995-01-31 + 1 month is
+ * 1995-02-28).
+ */
+constexpr date_t date_add_months(date_t d, int n) {
+  return make_date_clamped(date_year(d) * 12 + date_month(d) - 1 + n, date_day(d));
+}
+
+/** date + interval 'n' year. */
+constexpr date_t date_add_years(date_t d, int n) {
+  return date_add_months(d, n * 12);
+}
+
+/** Formats a date as YYYY-MM-DD. */
+std::string format_date(date_t d);
+
+/*
+ * Zone maps.
+ *
+ * A zone map stores the minimum and maximum value of a column for each zone
+ * of ZONE_ROWS consecutive rows. A scan filtering the column on a value range
+ * skips every zone whose [min, max] does not intersect the range, which pays
+ * off when the column is clustered (e.g. dates in a table sorted by date).
+ */
+#define ZONE_ROWS (1 << 16)
+
+template <typename T>
+struct ZoneMap {
+  T* min;
+  T* max;
+  int num_zones;
+
+  ZoneMap() : min(NULL), max(NULL), num_zones(0) {}
+
+  ~ZoneMap() {
+    delete[] min;
+    delete[] max;
+  }
+
+  /** (Re)builds the zone map over the first n values of column. */
+  void build(const T* column, int n) {
+    delete[] min;
+    delete[] max;
+    num_zones = (n + ZONE_ROWS - 1) / ZONE_ROWS;
+    min = new T[num_zones];
+    max = new T[num_zones];
+#pragma omp parallel for
+    for (int z = 0; z < num_zones; z++) {
+      int start = z * ZONE_ROWS;
+      int end = start + ZONE_ROWS < n ? start + ZONE_ROWS : n;
+      T lo = column[start], hi = column[start];
+      for (int i = start + 1; i < end; i++) {
+        lo = column[i] < lo ? column[i] : lo;
+        hi = column[i] > hi ? column[i] : hi;
+      }
+      min[z] = lo;
+      max[z] = hi;
+    }
+  }
+
+  /** Whether zone z may hold a value in [lo, hi). */
+  bool may_match(int z, T lo, T hi) const {
+    return max[z] >= lo && min[z] < hi;
+  }
+
+  /** Returns the number of zones that may hold a value in [lo, hi). */
+  int matching(T lo, T hi) const {
+    int count = 0;
+    for (int z = 0; z < num_zones; z++) {
+      count += may_match(z, lo, hi);
+    }
+    return count;
+  }
+
+  /** Calls scan(run_start, run_end) for each maximal run of rows in
+   * [start, end) whose zones may hold a value in [lo, hi). Scans all of
+   * [start, end) if the zone map was not built.
+   *
+   * @return the number of zones skipped.
+   */
+  template <typename F>
+  int scan(int start, int end, T lo, T hi, F scan) const {
+    if (num_zones == 0) {
+      scan(start, end);
+      return 0;
+    }
+
+    int skipped = 0;
+    int run_start = start;
+    for (int z = start / ZONE_ROWS; z * ZONE_ROWS < end; z++) {
+      if (may_match(z, lo, hi)) {
+        continue;
+      }
+      int zone_start = z * ZONE_ROWS > start ? z * ZONE_ROWS : start;
+      int zone_end = (z + 1) * ZONE_ROWS < end ? (z + 1) * ZONE_ROWS : end;
+      if (zone_start > run_start) {
+        scan(run_start, zone_start);
+      }
+      run_start = zone_end;
+      skipped++;
+    }
+    if (end > run_start) {
+      scan(run_start, end);
+    }
+    return skipped;
+  }
+};
+
+/*
+ * Morsel-driven parallelism.
+ *
+ * Parallel scans split their rows into morsels of MORSEL_ROWS rows, small
+ * enough for a morsel's columns to stay in cache. The threads of the OpenMP
+ * team (one per core unless OMP_NUM_THREADS says otherwise) claim morsels
+ * from a shared atomic counter until none are left, so threads that finish
+ * early take over the remaining work instead of idling when selectivity is
+ * skewed across the table.
+ */
+#define MORSEL_ROWS (1 << 14)
+
+/** Calls work(start, end) for each morsel of the rows [0, rows), in
+ * parallel.
+ */
+template <typename Work>
+void morsel_for(int rows, Work work) {
+  std::atomic<int> next(0);
+#pragma omp parallel
+  {
+    for (;;) {
+      int start = next.fetch_add(MORSEL_ROWS, std::memory_order_relaxed);
+      if (start >= rows) {
+        break;
+      }
+      work(start, start + MORSEL_ROWS < rows ? start + MORSEL_ROWS : rows);
+    }
+  }
+}
+
+/** Calls work(state, start, end) for each morsel of the rows [0, rows), in
+ * parallel. Each thread aggregates into its own copy of init, and the
+ * per-thread states are merged into another copy of init by a single
+ * merge(result, state) pass once all morsels are done, without locks. init
+ * must be an identity of merge (e.g. zero sums).
+ *
+ * @return the merged state
+ */
+template <typename State, typename Work, typename Merge>
+State morsel_reduce(int rows, const State& init, Work work, Merge merge) {
+  std::vector<State> states(omp_get_max_threads(), init);
+  std::atomic<int> next(0);
+#pragma omp parallel
+  {
+    // Aggregate on the thread's stack, so threads do not share cache lines.
+    State local = init;
+    for (;;) {
+      int start = next.fetch_add(MORSEL_ROWS, std::memory_order_relaxed);
+      if (start >= rows) {
+        break;
+      }
+      work(local, start, start + MORSEL_ROWS < rows ? start + MORSEL_ROWS : rows);
+    }
+    states[omp_get_thread_num()] = local;
+  }
+
+  State result = init;
+  for (size_t t = 0; t < states.size(); t++) {
+    merge(result, states[t]);
+  }
+  return result;
+}
+
+/** A projection of the lineitem columns used by the date-range queries (Q1,
+ * Q6, Q14), sorted by shipdate. Within a shipdate, rows keep their orderkey
+ * order. Built by build_shipdate_projection.
+ */
+struct LineitemByShipdate {
+  int rows;
+  date_t* shipdate;
+  uint8_t* quantity;
+  int* partkey;
+  decimal_t* extendedprice;
+  small_decimal_t* discount;
+  small_decimal_t* tax;
+  uint8_t* returnflag;
+  uint8_t* linestatus;
+
+  // Index of each row in the orderkey-sorted Lineitem.
+  int* rowid;
+
+  ZoneMap<date_t> shipdate_zones;
+
+  LineitemByShipdate(int n) : rows(n) {
+    shipdate = new date_t[n];
+    quantity = new uint8_t[n];
+    partkey = new int[n];
+    extendedprice = new decimal_t[n];
+    discount = new small_decimal_t[n];
+    tax = new small_decimal_t[n];
+    returnflag = new uint8_t[n];
+    linestatus = new uint8_t[n];
+    rowid = new int[n];
+  }
+
+  ~LineitemByShipdate() {
+    delete[] shipdate;
+    delete[] quantity;
+    delete[] partkey;
+    delete[] extendedprice;
+    delete[] discount;
+    delete[] tax;
+    delete[] returnflag;
+    delete[] linestatus;
+    delete[] rowid;
+  }
+
+  /** Returns the memory used by the projection, including its zone map. */
+  size_t bytes() const {
+    return (size_t) rows * (sizeof(*shipdate) + sizeof(*quantity) + sizeof(*partkey) +
+        sizeof(*extendedprice) + sizeof(*discount) + sizeof(*tax) + sizeof(*returnflag) +
+        sizeof(*linestatus) + sizeof(*rowid)) +
+      (size_t) shipdate_zones.num_zones * 2 * sizeof(date_t);
+  }
+};
+
+// Sorted by orderkey. Each column uses the narrowest type that holds its
+// values: quantity (1-50), the flags and the enum codes fit in a byte, and
+// dates are 16-bit date_t.
 struct Lineitem {
   int* orderkey;
-  int* quantity;
+  uint8_t* quantity;
   int* partkey;
-  double* extendedprice;
-  double* discount;
-  double* tax;
-  int* commitdate;
-  int* shipdate;
-  int* recieptdate;
-  int* shipinstruct;
-  int* shipmode;
-  int* returnflag;
-  int* linestatus;
-
-  // Index in the order table
+  decimal_t* extendedprice;
+  small_decimal_t* discount;
+  small_decimal_t* tax;
+  date_t* commitdate;
+  date_t* shipdate;
+  date_t* recieptdate;
+  uint8_t* shipinstruct;
+  uint8_t* shipmode;
+  uint8_t* returnflag;
+  uint8_t* linestatus;
+
+  // Join indexes: the row of the lineitem's order, filled by
+  // build_order_join_indexes, and of its part, filled by
+  // build_part_join_index.
   int* orderindex;
-  //Index in the part table
   int* partindex;
 
+  // Built by load_lineitem_table.
+  ZoneMap<date_t> shipdate_zones;
+  ZoneMap<date_t> recieptdate_zones;
+
+  // Built on demand by build_shipdate_projection, NULL until then.
+  LineitemByShipdate* by_shipdate;
+
   Lineitem(int n) {
     orderkey = new int[n];
-    quantity = new int[n];
+    quantity = new uint8_t[n];
     partkey = new int[n];
-    extendedprice = new double[n];
-    discount = new double[n];
-    tax = new double[n];
-    commitdate = new int[n];
-    shipdate = new int[n];
-    recieptdate = new int[n];
-    shipinstruct = new int[n];
-    shipmode = new int[n];
-    returnflag = new int[n];
-    linestatus = new int[n];
+    extendedprice = new decimal_t[n];
+    discount = new small_decimal_t[n];
+    tax = new small_decimal_t[n];
+    commitdate = new date_t[n];
+    shipdate = new date_t[n];
+    recieptdate = new date_t[n];
+    shipinstruct = new uint8_t[n];
+    shipmode = new uint8_t[n];
+    returnflag = new uint8_t[n];
+    linestatus = new uint8_t[n];
 
     partindex = new int[n];
     orderindex = new int[n];
+
+    by_shipdate = NULL;
   }
 
   ~Lineitem() {
-    delete orderkey;
-    delete quantity;
-    delete partkey;
-    delete extendedprice;
-    delete discount;
-    delete tax;
-    delete commitdate;
-    delete shipdate;
-    delete recieptdate;
-    delete shipinstruct;
-    delete shipmode;
-    delete returnflag;
-    delete linestatus;
-
-    delete partindex;
-    delete orderindex;
+    free_column(orderkey);
+    free_column(quantity);
+    free_column(partkey);
+    free_column(extendedprice);
+    free_column(discount);
+    free_column(tax);
+    free_column(commitdate);
+    free_column(shipdate);
+    free_column(recieptdate);
+    free_column(shipinstruct);
+    free_column(shipmode);
+    free_column(returnflag);
+    free_column(linestatus);
+
+    free_column(partindex);
+    free_column(orderindex);
+
+    delete by_shipdate;
+  }
+};
+
+/** A column of small unsigned integers packed at a fixed width of 1 to 8
+ * bits into 64-bit words. Values don't straddle words, so each word holds
+ * 64 / bits values and scans unpack a batch at a time with shifts and a mask.
+ */
+struct BitPackedColumn {
+  uint64_t* words;
+  size_t length;
+  int bits;
+  int per_word;
+  uint64_t mask;
+
+  BitPackedColumn(const uint8_t* values, size_t n, int width) :
+    length(n), bits(width), per_word(64 / width), mask((1ULL << width) - 1) {
+    size_t num_words = (n + per_word - 1) / per_word;
+    // One spare word, so unpack can always load the word after its last one.
+    words = new uint64_t[num_words + 1];
+    words[num_words] = 0;
+#pragma omp parallel for
+    for (size_t w = 0; w < num_words; w++) {
+      uint64_t word = 0;
+      size_t start = w * per_word;
+      for (int i = 0; i < per_word && start + i < n; i++) {
+        word |= (uint64_t) (values[start + i] & mask) << (i * bits);
+      }
+      words[w] = word;
+    }
+  }
+
+  ~BitPackedColumn() {
+    delete[] words;
+  }
+
+  /** Unpacks the values at [start, start + n) into out. */
+  void unpack(size_t start, size_t n, uint8_t* out) const {
+    size_t w = start / per_word;
+    int slot = start % per_word;
+    uint64_t word = words[w] >> (slot * bits);
+    for (size_t i = 0; i < n; i++) {
+      out[i] = word & mask;
+      word >>= bits;
+      if (++slot == per_word) {
+        slot = 0;
+        word = words[++w];
+      }
+    }
+  }
+
+  size_t bytes() const {
+    return ((length + per_word - 1) / per_word) * sizeof(uint64_t);
   }
 };
 
@@ -100,34 +549,39 @@ struct Lineitem {
 struct Order {
   int* orderkey;
   int* custkey;
-  int* orderdate;
+  date_t* orderdate;
   int* orderpriority;
   int* shippriority;
 
-  // For Q3
+  // Join indexes: the lineitem rows [li_start, li_end) of each order,
+  // filled by build_order_join_indexes, and the row of its customer, filled
+  // by build_customer_join_index.
   int* li_start;
   int* li_end;
+  int* custindex;
 
   Order(int n) {
     orderkey = new int[n];
     custkey = new int[n];
-    orderdate = new int[n];
+    orderdate = new date_t[n];
     orderpriority = new int[n];
     shippriority = new int[n];
 
     li_start = new int[n];
     li_end = new int[n];
+    custindex = new int[n];
   }
 
   ~Order() {
-    delete orderkey;
-    delete custkey;
-    delete orderdate;
-    delete orderpriority;
-    delete shippriority;
+    free_column(orderkey);
+    free_column(custkey);
+    free_column(orderdate);
+    free_column(orderpriority);
+    free_column(shippriority);
 
-    delete li_start;
-    delete li_end;
+    free_column(li_start);
+    free_column(li_end);
+    free_column(custindex);
   }
 };
 
@@ -147,28 +601,35 @@ struct Part {
   }
 
   ~Part() {
-    delete partkey;
-    delete brand;
-    delete size;
-    delete container;
-    delete promo_str;
+    free_column(partkey);
+    free_column(brand);
+    free_column(size);
+    free_column(container);
+    free_column(promo_str);
   }
 };
 
-// Here index + 1 is the order key.
 struct Customer {
+  int* custkey;
   int* mktsegment;
 
   Customer(int n) {
+    custkey = new int[n];
     mktsegment = new int[n];
   }
 
   ~Customer() {
-    delete mktsegment;
+    free_column(custkey);
+    free_column(mktsegment);
   }
 };
 
-/** Sets SF from the command line parameters.
+// Whether the load_*_table functions read and write binary snapshots.
+// Enabled by default, disabled with the -nosnapshot flag.
+extern bool use_snapshots;
+
+/** Sets SF from the command line parameters. Also handles the -nosnapshot
+ * flag, which makes the table loaders always parse the .tbl files.
  *
  * @param argc num of arguments
  * @param argv command line arguments
@@ -189,63 +650,183 @@ bool load_sf(int argc, char** argv, int& SF);
  */
 int binary_search(int* arr, int len, int e);
 
-/** Parse a date formated as YYYY-MM-DD into an integer, maintaining
- * sort order. Exits on failure.
+/** Parse a date formated as YYYY-MM-DD.
  *
- * @param date a properly formatted date string.
+ * @param date a properly formatted date string, not before 1992-01-01.
  *
- * @return an integer representing the date. The integer maintains
- * ordering (i.e. earlier dates have smaller values).
+ * @return the date as a date_t (days since 1992-01-01).
  *
  */
-int parse_date(const char* d);
+date_t parse_date(const char* d);
 
-/** Loads orders file.
- * If orders file is partitioned into many parts, each part can be loaded
- * in parallel.
+/*
+ * Runtime SIMD dispatch.
  *
- * @param orders array of uninitialized orders
- * @param tbl file pointer to table
- * @param partition file partition being loaded, used to
- * offset into arders array
- * @param num_parts total number of partitions
+ * Kernels that should run on any x86-64 host are compiled once per
+ * instruction set with a TARGET_* attribute (instead of -march=native), and
+ * the caller picks one at run time with detect_simd_level.
+ */
+typedef enum {
+  SIMD_SCALAR = 0,
+  SIMD_SSE4,
+  SIMD_AVX2,
+  SIMD_AVX512,
+} SimdLevel;
+
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+
+/** Returns the widest SIMD level the CPU and OS support, read with cpuid
+ * (through __builtin_cpu_supports). AVX-512 requires AVX512F and AVX512BW.
+ */
+SimdLevel detect_simd_level();
+
+/** Returns the name of a SIMD level, e.g. "AVX2". */
+const char* simd_level_name(SimdLevel level);
+
+/*
+ * Binary snapshots.
+ *
+ * After a table is parsed from its .tbl file(s) (see table_files), its loaded
+ * columns are written to <data_dir>/snapshot/ as one raw file per column
+ * (<table>.<column>.bin) plus a header (<table>.hdr) holding the row count,
+ * scale factor and column encoding. Later runs map the column files straight
+ * into the table structs instead of parsing the text again. A snapshot is
+ * only used if its header matches SNAPSHOT_VERSION, SNAPSHOT_ENCODING and the
+ * scale factor, and if the .tbl files still have the total size it was built
+ * from.
+ */
+
+#define SNAPSHOT_MAGIC 0x31534843505454ULL  // "TTPCHS1"
+#define SNAPSHOT_VERSION 1
+
+// Identifies the in-memory layout of the snapshotted columns. Must change
+// whenever the type or meaning of a loaded column changes.
+// 1: int32 keys and enums, YYYYMMDD int32 dates, double decimals.
+// 2: as 1, with decimals as decimal_t scaled by DECIMAL_SCALE.
+// 3: as 2, with lineitem quantity, discount, tax, flags and enums as uint8.
+// 4: as 3, with dates as date_t.
+#define SNAPSHOT_ENCODING 4
+
+struct SnapshotHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t encoding;
+  int64_t rows;
+  int32_t sf;
+  int32_t num_columns;
+  // Total size in bytes of the .tbl files the snapshot was built from.
+  int64_t source_size;
+};
+
+/** Loads the lineitem table of a data directory, from its snapshot if a
+ * valid one exists, and otherwise from lineitem.tbl or its split parts
+ * lineitem.tbl.<n> (writing a snapshot afterwards if use_snapshots is set).
+ * Then builds the zone maps of the date columns.
+ *
+ * @param lineitems lineitems with capacity for the whole table
+ * @param data_dir directory holding the .tbl files
  * @param sf scale factor
  *
+ * @return the number of rows loaded
  */
-void load_orders(Order* orders, FILE* tbl, int partition, int num_parts, int sf);
+int load_lineitem_table(Lineitem* lineitems, const std::string& data_dir, int sf);
 
-/** Loads customers file.
- * If customers file is partitioned into many parts, each part can be loaded
- * in parallel.
+/** Builds lineitems->by_shipdate, the shipdate-sorted projection of the
+ * first rows lineitems with a parallel counting sort, and prints its build
+ * time and memory overhead.
+ *
+ * @return lineitems->by_shipdate
+ */
+LineitemByShipdate* build_shipdate_projection(Lineitem* lineitems, int rows);
+
+/** Loads the orders table of a data directory. See load_lineitem_table. */
+int load_order_table(Order* orders, const std::string& data_dir, int sf);
+
+/** Loads the part table of a data directory. See load_lineitem_table. */
+int load_part_table(Part* parts, const std::string& data_dir, int sf);
+
+/** Loads the customer table of a data directory. See load_lineitem_table. */
+int load_customer_table(Customer* customers, const std::string& data_dir, int sf);
+
+/** Fills the join indexes between lineitem and orders, which must both be
+ * sorted by orderkey: lineitems->orderindex, and orders->li_start and
+ * li_end. They are built with a parallel merge of the two orderkey
+ * columns, split by merge path, and snapshotted like the tables (as
+ * lineitem_orderindex and orders_lineitems), so later runs map them.
+ */
+void build_order_join_indexes(Lineitem* lineitems, int lineitem_rows,
+    Order* orders, int order_rows, const std::string& data_dir, int sf);
+
+/** Fills lineitems->partindex, the row of each lineitem's part. parts must
+ * be sorted by partkey. Snapshotted as lineitem_partindex. Exits if a
+ * lineitem's part is missing.
+ */
+void build_part_join_index(Lineitem* lineitems, int lineitem_rows,
+    Part* parts, int part_rows, const std::string& data_dir, int sf);
+
+/** Fills orders->custindex, the row of each order's customer. customers
+ * must be sorted by custkey. Snapshotted as orders_custindex. Exits if an
+ * order's customer is missing.
+ */
+void build_customer_join_index(Order* orders, int order_rows,
+    Customer* customers, int customer_rows, const std::string& data_dir, int sf);
+
+/** Returns the .tbl files holding a table: <data_dir>/<table>.tbl if it
+ * exists, otherwise the parts <table>.tbl.1 ... <table>.tbl.<n> written by
+ * dbgen -C <n> -S <k>, in order. Empty if neither exists.
+ *
+ * @param data_dir directory holding the .tbl files
+ * @param table table name, e.g. "lineitem"
+ */
+std::vector<std::string> table_files(const std::string& data_dir, const char* table);
+
+/*
+ * The loaders below memory-map every file in paths, split each one into
+ * newline-aligned chunks, and parse the chunks of all files in parallel. Rows
+ * are stored in file order starting at offset; the row offset of every chunk
+ * is computed exactly from the row counts of the chunks before it.
+ */
+
+/** Loads orders files.
+ *
+ * @param orders array of uninitialized orders
+ * @param paths paths to the table files, in row order
+ * @param offset offset into the orders array
+ *
+ * @return the index just past the last row loaded
+ */
+int load_orders(Order* orders, const std::vector<std::string>& paths, int offset);
+
+/** Loads customers files.
  *
  * @param customers array of uninitialized customers
- * @param tbl file pointer to table
- * @param partition file partition being loaded, used to
- * offset into arders array
- * @param num_parts total number of partitions
- * @param sf scale factor
+ * @param paths paths to the table files, in row order
+ * @param offset offset into the customers array
  *
+ * @return the index just past the last row loaded
  */
-void load_customers(Customer* customers, FILE* tbl, int partition, int num_parts, int sf);
+int load_customers(Customer* customers, const std::vector<std::string>& paths, int offset);
 
-/** Loads lineitems file.
- * If lineitems file is partitioned into many parts, each part can be loaded
- * in parallel.
+/** Loads lineitems files.
  *
- * @param lineitems array of uninitialized customers
- * @param tbl file pointer to table
+ * @param lineitems array of uninitialized lineitems
+ * @param paths paths to the table files, in row order
  * @param offset offset into the lineitems array
  *
+ * @return the index just past the last row loaded
  */
-int load_lineitems(Lineitem* lineitems, FILE* tbl, int offset);
+int load_lineitems(Lineitem* lineitems, const std::vector<std::string>& paths, int offset);
 
-/** Loads the parts file
- *  If parts file is partitioned into many parts, each part can be loaded
- *  in parallel.
+/** Loads parts files.
+ *
  * @param parts array of unintialized parts
- * @param tbl file pointer to table
+ * @param paths paths to the table files, in row order
  * @param offset offset into the parts array
+ *
+ * @return the index just past the last row loaded
  */
-void load_parts(Part* parts, FILE* tbl, int offset);
-
+int load_parts(Part* parts, const std::vector<std::string>& paths, int offset);
 
+#endif
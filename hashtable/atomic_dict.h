@@ -0,0 +1,123 @@
+#ifndef __NVL_ATOMIC_DICT_H__
+#define __NVL_ATOMIC_DICT_H__
+
+#include <stdlib.h>
+#include <atomic>
+#include <limits>
+
+#include "swiss_dict.h"
+
+/** Adds value to an atomic integer. */
+template<typename V>
+inline void atomic_add(std::atomic<V>& into, V value) {
+  into.fetch_add(value, std::memory_order_relaxed);
+}
+
+/** Adds value to an atomic floating point number, which has no fetch_add, with a CAS loop. */
+template<typename V>
+inline void atomic_add_cas(std::atomic<V>& into, V value) {
+  V old = into.load(std::memory_order_relaxed);
+  while (!into.compare_exchange_weak(old, old + value, std::memory_order_relaxed)) {
+  }
+}
+
+template<>
+inline void atomic_add<double>(std::atomic<double>& into, double value) {
+  atomic_add_cas(into, value);
+}
+
+template<>
+inline void atomic_add<float>(std::atomic<float>& into, float value) {
+  atomic_add_cas(into, value);
+}
+
+/**
+ * Append-only dictionary for aggregating from many threads at once, without locks. Like Dict, put
+ * adds value to the value of an existing key.
+ *
+ * Each slot is an atomic key and an atomic value, 8 bytes for an AtomicDict<int, int>. An unused
+ * slot holds the empty key, which cannot be put. A thread claims a slot for a key by a CAS of its
+ * key word from empty to the key; a thread that loses the race finds the winner's key and, if it is
+ * the same key, aggregates into the same slot. Values are aggregated with an atomic fetch-add (or a
+ * CAS loop for floating point values), and the size is counted with an atomic increment by the
+ * thread whose CAS claimed the slot.
+ *
+ * The capacity is fixed, a power of 2. Probing is quadratic.
+ */
+template<typename K, typename V>
+class AtomicDict {
+  struct Slot { std::atomic<K> key; std::atomic<V> value; };
+
+  Slot *_slots;
+  std::atomic<size_t> _size;  // Number of slots claimed
+  size_t _capacity;           // Total number of slots
+  K _empty;
+
+public:
+  AtomicDict(size_t capacity, K empty = std::numeric_limits<K>::min()):
+    _size(0), _capacity(capacity), _empty(empty) {
+    _slots = new Slot[capacity];
+    for (size_t i = 0; i < capacity; i++) {
+      _slots[i].key.store(empty, std::memory_order_relaxed);
+      _slots[i].value.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  ~AtomicDict() { delete[] _slots; }
+
+  /**
+   * Looks up the value for a given key into value. Returns false if it is missing. A key being put
+   * concurrently may be seen before all of its values are added.
+   */
+  bool get(const K& key, V& value) const {
+    size_t mask = _capacity - 1;
+    size_t pos = swiss_hash((uint64_t) key) & mask;
+    for (size_t step = 1; step <= _capacity; step++) {
+      K k = _slots[pos].key.load(std::memory_order_acquire);
+      if (k == key) {
+        value = _slots[pos].value.load(std::memory_order_relaxed);
+        return true;
+      }
+      if (k == _empty) {
+        return false;
+      }
+      pos = (pos + step) & mask;
+    }
+    return false;
+  }
+
+  /**
+   * Adds a value to the given key, inserting it if it is missing. Returns false, without adding,
+   * if the key is missing and the table is full.
+   */
+  bool put(const K& key, const V& value) {
+    size_t mask = _capacity - 1;
+    size_t pos = swiss_hash((uint64_t) key) & mask;
+    for (size_t step = 1; step <= _capacity; step++) {
+      K k = _slots[pos].key.load(std::memory_order_acquire);
+      if (k == _empty) {
+        // On failure, k is the key that another thread claimed the slot for.
+        if (_slots[pos].key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+          _size.fetch_add(1, std::memory_order_relaxed);
+          k = key;
+        }
+      }
+      if (k == key) {
+        atomic_add(_slots[pos].value, value);
+        return true;
+      }
+      pos = (pos + step) & mask;
+    }
+    return false;
+  }
+
+  size_t size() const {
+    return _size.load(std::memory_order_relaxed);
+  }
+
+private:
+  AtomicDict(const AtomicDict<K, V>&);
+  AtomicDict<K, V>& operator = (const AtomicDict<K, V>&);
+};
+
+#endif // __NVL_ATOMIC_DICT_H__
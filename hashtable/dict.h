@@ -8,6 +8,8 @@ size_t hash(int v) { return v; }
 namespace {
 const size_t INITIAL_SIZE = 16;
 const double LOAD_FACTOR = 0.7;
+// How many keys ahead get_batch and put_batch prefetch slots.
+const size_t PREFETCH_DISTANCE = 32;
 }
 
 /**
@@ -63,6 +65,48 @@ public:
     return 0;
   }
 
+  /**
+   * Sets out[i] to a pointer to the value for keys[i], or null if it is missing, for n keys.
+   *
+   * Prefetches the first slot of the key PREFETCH_DISTANCE keys ahead while probing each key
+   * (software-pipelined prefetching), so that the cache misses of a table larger than the cache
+   * overlap with the probes in between instead of stalling each probe.
+   */
+  void get_batch(const K* keys, size_t n, V** out) {
+    if (!_entries) {
+      for (size_t i = 0; i < n; i++) {
+        out[i] = 0;
+      }
+      return;
+    }
+    size_t mask = _capacity - 1;
+    for (size_t i = 0; i < n && i < PREFETCH_DISTANCE; i++) {
+      __builtin_prefetch(&_entries[hash(keys[i]) & mask]);
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (i + PREFETCH_DISTANCE < n) {
+        __builtin_prefetch(&_entries[hash(keys[i + PREFETCH_DISTANCE]) & mask]);
+      }
+      out[i] = get(keys[i]);
+    }
+  }
+
+  /** Puts values[i] with keys[i], as put does, for n keys, prefetching as get_batch does. */
+  void put_batch(const K* keys, const V* values, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      if (_size >= LOAD_FACTOR * _capacity) {
+        growAndRehash();
+      }
+      // A slot prefetched before the table grows is only a wasted prefetch.
+      if (i + PREFETCH_DISTANCE < n) {
+        __builtin_prefetch(&_entries[hash(keys[i + PREFETCH_DISTANCE]) & (_capacity - 1)], 1);
+      }
+      if (putInto(_entries, _capacity, keys[i], values[i])) {
+        _size += 1;
+      }
+    }
+  }
+
   /** Insert a value with the given key, overriding any previous one */
   void put(const K& key, const V& value) {
     if (_size >= LOAD_FACTOR * _capacity) {
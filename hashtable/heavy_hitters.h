@@ -0,0 +1,147 @@
+#ifndef __NVL_HEAVY_HITTERS_H__
+#define __NVL_HEAVY_HITTERS_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "dict.h"
+#include "capped_dict.h"
+
+/**
+ * Detection of the heavy hitters of skewed keys, so that they can be aggregated outside the shared
+ * table. Every thread putting the same hot key into a shared table writes the same slot, whose
+ * cache line then bounces between the cores, and every hot key's tuples go to the same radix
+ * partition. Instead, each thread counts its hot keys in a small array of its own, HH_BATCH keys
+ * at a time, which is merged into the table once, with one put per hot key and thread.
+ *
+ * The hot keys are found from a strided sample of HH_SAMPLE keys: at most HH_MAX_KEYS of the keys
+ * that make up at least HH_MIN_SHARE of the sample, the most frequent first.
+ */
+#define HH_SAMPLE (1 << 14)
+#define HH_MAX_KEYS 16
+#define HH_MIN_SHARE 0.01
+// Keys filtered at a time, whose counts fit the int lanes.
+#define HH_BATCH 1024
+
+struct HeavyHitters {
+  int keys[HH_MAX_KEYS];
+  int count;
+
+  HeavyHitters(): count(0) {
+    memset(keys, 0, sizeof(keys));
+  }
+
+  /**
+   * Adds the number of times each heavy hitter h occurs in keys[0, n) to counts[h], and writes the
+   * other keys to rest, in order. Returns the number of other keys.
+   *
+   * Each key is compared to all heavy hitters at once, with SSE2 (4 keys) or AVX2 (8 keys)
+   * instructions, and the matches are counted in vector registers, so that the loop has no
+   * branches, which would mispredict on the mix of hot and other keys, and no stores to the same
+   * counter back to back.
+   */
+  int filter(const int* keys_in, int n, int* counts, int* rest) const {
+    if (count == 0) {
+      memcpy(rest, keys_in, n * sizeof(int));
+      return n;
+    }
+    int valid[HH_MAX_KEYS];
+    for (int h = 0; h < HH_MAX_KEYS; h++) {
+      valid[h] = h < count ? -1 : 0;
+    }
+    int sums[HH_MAX_KEYS];
+    int m = 0;
+#ifdef __AVX2__
+    const int lanes = 8;
+    __m256i hot[HH_MAX_KEYS / 8], mask[HH_MAX_KEYS / 8], acc[HH_MAX_KEYS / 8];
+    for (int v = 0; v < HH_MAX_KEYS / lanes; v++) {
+      hot[v] = _mm256_loadu_si256((const __m256i*) (keys + v * lanes));
+      mask[v] = _mm256_loadu_si256((const __m256i*) (valid + v * lanes));
+      acc[v] = _mm256_setzero_si256();
+    }
+    for (int i = 0; i < n; i++) {
+      __m256i k = _mm256_set1_epi32(keys_in[i]);
+      __m256i any = _mm256_setzero_si256();
+      for (int v = 0; v < HH_MAX_KEYS / lanes; v++) {
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi32(hot[v], k), mask[v]);
+        acc[v] = _mm256_sub_epi32(acc[v], eq);
+        any = _mm256_or_si256(any, eq);
+      }
+      rest[m] = keys_in[i];
+      m += _mm256_testz_si256(any, any);
+    }
+    for (int v = 0; v < HH_MAX_KEYS / lanes; v++) {
+      _mm256_storeu_si256((__m256i*) (sums + v * lanes), acc[v]);
+    }
+#else
+    const int lanes = 4;
+    __m128i hot[HH_MAX_KEYS / 4], mask[HH_MAX_KEYS / 4], acc[HH_MAX_KEYS / 4];
+    for (int v = 0; v < HH_MAX_KEYS / lanes; v++) {
+      hot[v] = _mm_loadu_si128((const __m128i*) (keys + v * lanes));
+      mask[v] = _mm_loadu_si128((const __m128i*) (valid + v * lanes));
+      acc[v] = _mm_setzero_si128();
+    }
+    for (int i = 0; i < n; i++) {
+      __m128i k = _mm_set1_epi32(keys_in[i]);
+      __m128i any = _mm_setzero_si128();
+      for (int v = 0; v < HH_MAX_KEYS / lanes; v++) {
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi32(hot[v], k), mask[v]);
+        acc[v] = _mm_sub_epi32(acc[v], eq);
+        any = _mm_or_si128(any, eq);
+      }
+      rest[m] = keys_in[i];
+      m += _mm_movemask_epi8(any) == 0;
+    }
+    for (int v = 0; v < HH_MAX_KEYS / lanes; v++) {
+      _mm_storeu_si128((__m128i*) (sums + v * lanes), acc[v]);
+    }
+#endif
+    for (int h = 0; h < count; h++) {
+      counts[h] += sums[h];
+    }
+    return m;
+  }
+};
+
+/** Finds the heavy hitters of keys[0, num_tuples) from a sample. */
+inline HeavyHitters detect_heavy_hitters(const int* keys, int num_tuples) {
+  HeavyHitters hitters;
+  int samples = num_tuples < HH_SAMPLE ? num_tuples : HH_SAMPLE;
+  if (samples == 0) {
+    return hitters;
+  }
+
+  // Twice the sample. A CappedDict probes a few slots only, so a sampled key may still not fit,
+  // but only a rare one: a frequent key is found, and added, on its first occurrences.
+  CappedDict<int, int> counts(2 * HH_SAMPLE);
+  int stride = num_tuples / samples;
+  for (int i = 0; i < samples; i++) {
+    counts.put(keys[(size_t) i * stride], 1);
+  }
+
+  // Keeps the most frequent keys in keys, sorted by decreasing frequency.
+  int frequencies[HH_MAX_KEYS];
+  int min_frequency = (int) (samples * HH_MIN_SHARE);
+  for (size_t j = 0; j < counts._capacity; j++) {
+    if (!counts._entries[j].filled || counts._entries[j].value < min_frequency) {
+      continue;
+    }
+    int frequency = counts._entries[j].value;
+    int h = hitters.count < HH_MAX_KEYS ? hitters.count++ : HH_MAX_KEYS;
+    for (; h > 0 && frequencies[h - 1] < frequency; h--) {
+      if (h < HH_MAX_KEYS) {
+        hitters.keys[h] = hitters.keys[h - 1];
+        frequencies[h] = frequencies[h - 1];
+      }
+    }
+    if (h < HH_MAX_KEYS) {
+      hitters.keys[h] = counts._entries[j].key;
+      frequencies[h] = frequency;
+    }
+  }
+  return hitters;
+}
+
+#endif // __NVL_HEAVY_HITTERS_H__
@@ -0,0 +1,128 @@
+#ifndef __NVL_RADIX_PARTITION_H__
+#define __NVL_RADIX_PARTITION_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <emmintrin.h>
+
+#include "swiss_dict.h"
+
+/**
+ * Radix partitioning of (key, value) tuples by bits of their key's hash, for aggregation.
+ *
+ * A partition pass first counts the tuples of each partition (a histogram), so that every
+ * partition, and every thread's part of it, gets an exact region of the output. The scatter then
+ * goes through a software write-combining buffer per partition: one cache line, filled in cache and
+ * written out whole with non-temporal stores, which go straight to memory without first reading
+ * the line (as a plain store would) or evicting the buffers from the cache. With 2^bits partitions
+ * the buffers take 2^bits cache lines, so a pass of at most ~8 bits keeps them in L1; more
+ * partitions take more passes.
+ *
+ * Regions start on a cache line, so that the buffers can be flushed aligned. The last line of a
+ * region is padded with RADIX_PAD_KEY tuples, which readers skip.
+ */
+#define RADIX_CACHE_LINE 64
+#define RADIX_PAD_KEY INT_MIN
+
+struct RadixTuple { int key; int value; };
+
+#define RADIX_LINE_TUPLES (RADIX_CACHE_LINE / (int) sizeof(RadixTuple))
+
+/** Rounds a number of tuples up to whole cache lines. */
+inline size_t radix_lines(size_t n) {
+  return (n + RADIX_LINE_TUPLES - 1) / RADIX_LINE_TUPLES * RADIX_LINE_TUPLES;
+}
+
+/** The partition of a key, bits [shift, shift + bits) of its hash. */
+inline int radix_partition_of(int key, int shift, int bits) {
+  return (swiss_hash((uint64_t) key) >> shift) & ((1 << bits) - 1);
+}
+
+/** Allocates n tuples aligned to a cache line. Free with free(). */
+inline RadixTuple* radix_alloc(size_t n) {
+  size_t bytes = radix_lines(n > 0 ? n : 1) * sizeof(RadixTuple);
+  return (RadixTuple*) aligned_alloc(RADIX_CACHE_LINE, bytes);
+}
+
+/** Adds the number of tuples of in[0, n) in each partition to counts, skipping pads. */
+inline void radix_histogram(const RadixTuple* in, size_t n, int shift, int bits, size_t* counts) {
+  for (size_t i = 0; i < n; i++) {
+    if (in[i].key != RADIX_PAD_KEY) {
+      counts[radix_partition_of(in[i].key, shift, bits)]++;
+    }
+  }
+}
+
+/**
+ * Scatters the tuples of in[0, n) into out, partition p starting at out + offsets[p], which must
+ * be cache line aligned with room for radix_lines() of the partition's count. Pads are skipped in
+ * the input and written to fill each partition's last line.
+ */
+inline void radix_scatter(const RadixTuple* in, size_t n, int shift, int bits,
+    RadixTuple* out, const size_t* offsets) {
+  int partitions = 1 << bits;
+  union Line {
+    RadixTuple tuples[RADIX_LINE_TUPLES];
+    __m128i vectors[RADIX_CACHE_LINE / 16];
+  };
+  Line* buffers = (Line*) aligned_alloc(RADIX_CACHE_LINE, partitions * sizeof(Line));
+  int* fill = (int*) calloc(partitions, sizeof(int));
+  size_t* cursors = (size_t*) malloc(partitions * sizeof(size_t));
+  memcpy(cursors, offsets, partitions * sizeof(size_t));
+
+  for (size_t i = 0; i < n; i++) {
+    if (in[i].key == RADIX_PAD_KEY) {
+      continue;
+    }
+    int p = radix_partition_of(in[i].key, shift, bits);
+    buffers[p].tuples[fill[p]++] = in[i];
+    if (fill[p] == RADIX_LINE_TUPLES) {
+      __m128i* line = (__m128i*) (out + cursors[p]);
+      for (int v = 0; v < RADIX_CACHE_LINE / 16; v++) {
+        _mm_stream_si128(line + v, buffers[p].vectors[v]);
+      }
+      cursors[p] += RADIX_LINE_TUPLES;
+      fill[p] = 0;
+    }
+  }
+  // The partial lines, padded.
+  for (int p = 0; p < partitions; p++) {
+    if (fill[p] > 0) {
+      for (int k = fill[p]; k < RADIX_LINE_TUPLES; k++) {
+        buffers[p].tuples[k].key = RADIX_PAD_KEY;
+        buffers[p].tuples[k].value = 0;
+      }
+      memcpy(out + cursors[p], buffers[p].tuples, RADIX_CACHE_LINE);
+    }
+  }
+  _mm_sfence();
+
+  free(buffers);
+  free(fill);
+  free(cursors);
+}
+
+/**
+ * Partitions in[0, n) by bits [shift, shift + bits) of the hash into a newly allocated array,
+ * which it returns, and sets starts[p] to the start of partition p; starts[2^bits] is the end.
+ * starts must have room for 2^bits + 1 entries.
+ */
+inline RadixTuple* radix_partition(const RadixTuple* in, size_t n, int shift, int bits,
+    size_t* starts) {
+  int partitions = 1 << bits;
+  size_t* counts = (size_t*) calloc(partitions, sizeof(size_t));
+  radix_histogram(in, n, shift, bits, counts);
+  starts[0] = 0;
+  for (int p = 0; p < partitions; p++) {
+    starts[p + 1] = starts[p] + radix_lines(counts[p]);
+  }
+  free(counts);
+
+  RadixTuple* out = radix_alloc(starts[partitions]);
+  radix_scatter(in, n, shift, bits, out, starts);
+  return out;
+}
+
+#endif // __NVL_RADIX_PARTITION_H__
@@ -1,17 +1,36 @@
 #include <string>
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 #include <sys/time.h>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <omp.h>
 #include "dict.h"
+#include "swiss_dict.h"
 #include "capped_dict.h"
-#include "synchronized_dict.h"
+#include "atomic_dict.h"
+#include "radix_partition.h"
+#include "heavy_hitters.h"
 using namespace std;
 
-#define NUM_TUPLES 1<<29 // 536 million.
+#define NUM_TUPLES (1 << 29) // 536 million.
 #define NUM_THREADS 8
+// Tuples inserted into each table in the single-threaded comparison.
+#define TABLE_TUPLES (1 << 25)
+// Keys per put_batch and get_batch call in the single-threaded comparison.
+#define BATCH_TUPLES 1024
+// Capacity of each thread's local table in PLAT.
+#define PLAT_LOCAL_CAPACITY (1 << 16)
+// Hash bits PLAT partitions by, and the passes it splits them over.
+#define PLAT_RADIX_BITS 12
+#define PLAT_PASSES 2
+// Threads the parallel strategies are compared with.
+static const int THREAD_COUNTS[] = {1, 2, 4, NUM_THREADS};
+#define NUM_THREAD_COUNTS 4
+// Equal keys per run of the clustered distribution.
+#define CLUSTER_RUN 64
 typedef long long i64;
 
 /***********************************
@@ -20,8 +39,13 @@ typedef long long i64;
  *
  * single_thread_stl => Single thread agg using STL
  * single_thread_with_probe => Single thread using NVL Dict
+ * single_thread_swiss => Single thread using SwissDict
  * independent_with_probe => Independent hash table per thread + merge
- * global_table => Uses a global hash table
+ * global_table => Uses a global lock-free hash table
+ * plat => Local tables, then a radix partitioned aggregation
+ *
+ * global_table can aggregate the heavy hitters of skewed keys on the side, in
+ * per-thread arrays (see heavy_hitters.h).
  *
  * *******************************/
 
@@ -31,11 +55,17 @@ void dict_worker(Dict<int, int>& dict, int* keys, int start, int end) {
   }
 }
 
+void swiss_worker(SwissDict<int, int>& dict, int* keys, int start, int end) {
+  for (int i=start; i<end; i++) {
+    dict.put(keys[i], 1);
+  }
+}
+
 // Much slower than the nvl implementation.
 void single_thread_stl(int* keys, int num_tuples) {
   unordered_map<int, int> dict;
   for (int i=0; i<num_tuples; i++) {
-    dict.insert(make_pair<int, int>(keys[i], 1));
+    dict[keys[i]] += 1;
   }
 }
 
@@ -44,6 +74,93 @@ void single_thread_with_probe(int* keys, int num_tuples) {
   dict_worker(dict, keys, 0, num_tuples);
 }
 
+void single_thread_swiss(int* keys, int num_tuples) {
+  SwissDict<int, int> dict;
+  swiss_worker(dict, keys, 0, num_tuples);
+}
+
+double seconds_since(const struct timeval& before) {
+  struct timeval after, diff;
+  gettimeofday(&after, 0);
+  timersub(&after, &before, &diff);
+  return diff.tv_sec + diff.tv_usec / 1e6;
+}
+
+/**
+ * Aggregates the keys on one thread with each table, then looks every key up again, and prints
+ * the millions of tuples per second of both, put then get.
+ */
+template <typename Table, typename Put, typename Get>
+void compare_table(const char* name, int* keys, int num_tuples, Put put, Get get) {
+  struct timeval before;
+  Table dict;
+
+  gettimeofday(&before, 0);
+  for (int i=0; i<num_tuples; i++) {
+    put(dict, keys[i]);
+  }
+  double put_seconds = seconds_since(before);
+
+  gettimeofday(&before, 0);
+  long found = 0;
+  for (int i=0; i<num_tuples; i++) {
+    found += get(dict, keys[i]);
+  }
+  double get_seconds = seconds_since(before);
+
+  printf(" %s %.1f/%.1f", name, num_tuples / put_seconds / 1e6, num_tuples / get_seconds / 1e6);
+  if (found != num_tuples) {
+    printf(" (missed %ld keys)", num_tuples - found);
+  }
+}
+
+/** As compare_table, for Dict's batched put_batch and get_batch, BATCH_TUPLES keys per call. */
+void compare_dict_batch(int* keys, int num_tuples) {
+  struct timeval before;
+  Dict<int, int> dict;
+  int ones[BATCH_TUPLES];
+  int* values[BATCH_TUPLES];
+  for (int k=0; k<BATCH_TUPLES; k++) {
+    ones[k] = 1;
+  }
+
+  gettimeofday(&before, 0);
+  for (int i=0; i<num_tuples; i+=BATCH_TUPLES) {
+    dict.put_batch(keys + i, ones, min(BATCH_TUPLES, num_tuples - i));
+  }
+  double put_seconds = seconds_since(before);
+
+  gettimeofday(&before, 0);
+  long found = 0;
+  for (int i=0; i<num_tuples; i+=BATCH_TUPLES) {
+    int n = min(BATCH_TUPLES, num_tuples - i);
+    dict.get_batch(keys + i, n, values);
+    for (int k=0; k<n; k++) {
+      found += values[k] != 0;
+    }
+  }
+  double get_seconds = seconds_since(before);
+
+  printf(" dict_batch %.1f/%.1f", num_tuples / put_seconds / 1e6, num_tuples / get_seconds / 1e6);
+  if (found != num_tuples) {
+    printf(" (missed %ld keys)", num_tuples - found);
+  }
+}
+
+void compare_tables(int* keys, int num_tuples) {
+  compare_table<Dict<int, int> >("dict", keys, num_tuples,
+      [](Dict<int, int>& d, int key) { d.put(key, 1); },
+      [](Dict<int, int>& d, int key) { return d.get(key) != 0; });
+  compare_dict_batch(keys, num_tuples);
+  compare_table<SwissDict<int, int> >("swiss", keys, num_tuples,
+      [](SwissDict<int, int>& d, int key) { d.put(key, 1); },
+      [](SwissDict<int, int>& d, int key) { return d.get(key) != 0; });
+  compare_table<unordered_map<int, int> >("stl", keys, num_tuples,
+      [](unordered_map<int, int>& d, int key) { d[key] += 1; },
+      [](unordered_map<int, int>& d, int key) { return d.find(key) != d.end(); });
+  printf(" Mtuples/s (put/get)\n");
+}
+
 void independent_with_probe(int* keys, int num_tuples) {
   Dict<int, int> dicts[NUM_THREADS];
 
@@ -70,81 +187,160 @@ void independent_with_probe(int* keys, int num_tuples) {
 #endif
 }
 
-void sync_dict_worker(SynchronizedDict<int, int>& dict, int* keys, int start, int end) {
-  for (int i=start; i<end; i++) {
-    dict.put(keys[i], 1);
+void atomic_dict_worker(AtomicDict<int, int>& dict, const HeavyHitters& hot,
+    int* keys, int start, int end) {
+  int hot_counts[HH_MAX_KEYS] = {0};
+  int rest[HH_BATCH];
+  for (int base=start; base<end; base+=HH_BATCH) {
+    int n = hot.filter(keys + base, min(HH_BATCH, end - base), hot_counts, rest);
+    for (int k=0; k<n; k++) {
+      dict.put(rest[k], 1);
+    }
+  }
+  for (int h=0; h<hot.count; h++) {
+    if (hot_counts[h] > 0) {
+      dict.put(hot.keys[h], hot_counts[h]);
+    }
   }
 }
 
-void global_table(int* keys, int num_tuples, int capacity) {
-  SynchronizedDict<int, int> dict(capacity);
+void global_table(int* keys, int num_tuples, int capacity, bool heavy_hitters) {
+  AtomicDict<int, int> dict(capacity);
+  HeavyHitters hot;
+  if (heavy_hitters) {
+    hot = detect_heavy_hitters(keys, num_tuples);
+  }
 
 #pragma omp parallel for
   for (int i=0; i<NUM_THREADS; i++) {
     int start = i * (num_tuples / NUM_THREADS);
     int end = (i+1) * (num_tuples / NUM_THREADS);
-    sync_dict_worker(dict, keys, start, end);
+    atomic_dict_worker(dict, hot, keys, start, end);
   }
 
   printf("Global: Result Cardinality: %d\n", (int)dict.size());
 }
 
-void hybrid_worker(int* keys, int start, int end,
-    CappedDict<int, int>& dict, vector<int>* buffers) {
-  int mask = NUM_THREADS - 1;
+/**
+ * Aggregates keys[start, end) into the local table, and writes the tuples that do not fit it,
+ * followed by the local table's aggregates, to spill. Returns the number of tuples spilled.
+ */
+size_t hybrid_worker(int* keys, int start, int end,
+    CappedDict<int, int>& dict, RadixTuple* spill) {
+  size_t spilled = 0;
   for (int i=start; i<end; i++) {
     bool success = dict.put(keys[i], 1);
     if (!success) {
-      int index = keys[i] & mask;
-      buffers[index].push_back(keys[i]);
+      spill[spilled].key = keys[i];
+      spill[spilled].value = 1;
+      spilled++;
+    }
+  }
+  for (size_t j=0; j<dict._capacity; j++) {
+    if (dict._entries[j].filled) {
+      spill[spilled].key = dict._entries[j].key;
+      spill[spilled].value = dict._entries[j].value;
+      spilled++;
     }
   }
+  return spilled;
 }
 
-void plat(int* keys, int num_tuples) {
-  vector<int> buffers[NUM_THREADS][NUM_THREADS];
+/**
+ * Aggregates the tuples of a partition, in[0, n), into a Dict, after partitioning them further
+ * by passes more passes of bits bits each, from bit shift of the hash. Returns the number of
+ * distinct keys.
+ */
+size_t plat_aggregate(const RadixTuple* in, size_t n, int shift, int bits, int passes) {
+  if (passes == 0) {
+    Dict<int, int> dict;
+    for (size_t i=0; i<n; i++) {
+      if (in[i].key != RADIX_PAD_KEY) {
+        dict.put(in[i].key, in[i].value);
+      }
+    }
+    return dict.size();
+  }
+
+  size_t* starts = new size_t[(1 << bits) + 1];
+  RadixTuple* out = radix_partition(in, n, shift, bits, starts);
+  size_t result_size = 0;
+  for (int p=0; p<(1 << bits); p++) {
+    result_size += plat_aggregate(out + starts[p], starts[p+1] - starts[p],
+        shift + bits, bits, passes - 1);
+  }
+  free(out);
+  delete[] starts;
+  return result_size;
+}
+
+/**
+ * Partition and Local Aggregation Table. Each thread first aggregates its tuples in a small local
+ * table, which absorbs the frequent keys, and spills the rest. The spilled tuples are then radix
+ * partitioned by radix_bits bits of the key's hash, over passes passes (see radix_partition.h): the
+ * first pass is a parallel scatter of every thread's tuples, the later ones partition each
+ * partition on its own. Every key ends up in exactly one partition, so the partitions are
+ * aggregated into separate Dicts in parallel, with no merge.
+ *
+ * Skewed keys need no special handling here: a hot key is in the local tables from its first
+ * occurrences, so each thread spills it once, aggregated, and its partition is no larger.
+ */
+void plat(int* keys, int num_tuples, int radix_bits, int passes) {
+  int pass_bits = radix_bits / passes;
+  int first_bits = radix_bits - (passes - 1) * pass_bits;
+  int partitions = 1 << first_bits;
 
   CappedDict<int, int> local_dicts[NUM_THREADS];
   for (int i=0; i<NUM_THREADS; i++)
-    local_dicts[i].set_max_capacity(1 << 16);
+    local_dicts[i].set_max_capacity(PLAT_LOCAL_CAPACITY);
+
+  RadixTuple* spills[NUM_THREADS];
+  size_t spilled[NUM_THREADS];
+  // Tuples per thread and partition.
+  size_t* counts = new size_t[NUM_THREADS * partitions]();
 
 #pragma omp parallel for
   for (int i=0; i<NUM_THREADS; i++) {
     int start = i * (num_tuples / NUM_THREADS);
     int end = (i+1) * (num_tuples / NUM_THREADS);
-    hybrid_worker(keys, start, end, local_dicts[i], buffers[i]);
+    spills[i] = radix_alloc(end - start + PLAT_LOCAL_CAPACITY);
+    spilled[i] = hybrid_worker(keys, start, end, local_dicts[i], spills[i]);
+    radix_histogram(spills[i], spilled[i], 0, first_bits, counts + i * partitions);
   }
 
-  Dict<int, int> partitioned_dicts[NUM_THREADS];
-#pragma omp parallel for
-  for (int i=0; i<NUM_THREADS; i++) {
-    for (int j=0; j<NUM_THREADS; j++) {
-      vector<int>& vec = buffers[j][i];
-      int vec_size = vec.size();
-      for (int k=0; k<vec_size; k++) {
-        partitioned_dicts[i].put(vec[k], 1);
-      }
+  // Partition p holds the tuples of thread 0, then thread 1 and so on, each from a cache line.
+  size_t* offsets = new size_t[NUM_THREADS * partitions];
+  size_t* starts = new size_t[partitions + 1];
+  size_t total = 0;
+  for (int p=0; p<partitions; p++) {
+    starts[p] = total;
+    for (int i=0; i<NUM_THREADS; i++) {
+      offsets[i * partitions + p] = total;
+      total += radix_lines(counts[i * partitions + p]);
     }
   }
+  starts[partitions] = total;
+  RadixTuple* partitioned = radix_alloc(total);
 
-  int mask = NUM_THREADS - 1;
+#pragma omp parallel for
   for (int i=0; i<NUM_THREADS; i++) {
-    for (int j=0; j<local_dicts[i]._capacity; j++) {
-      if (local_dicts[i]._entries[j].filled) {
-        int key = local_dicts[i]._entries[j].key;
-        int value = local_dicts[i]._entries[j].value;
-        int bucket = key & mask;
-        partitioned_dicts[bucket].put(key, value);
-      }
-    }
+    radix_scatter(spills[i], spilled[i], 0, first_bits, partitioned, offsets + i * partitions);
+    free(spills[i]);
   }
 
-  int result_size = 0;
-  for (int i=0; i<NUM_THREADS; i++) {
-    result_size += (int) partitioned_dicts[i].size();
+  size_t result_size = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:result_size)
+  for (int p=0; p<partitions; p++) {
+    result_size += plat_aggregate(partitioned + starts[p], starts[p+1] - starts[p],
+        first_bits, pass_bits, passes - 1);
   }
 
-  printf("PLAT: Result Cardinality: %d\n", result_size);
+  free(partitioned);
+  delete[] counts;
+  delete[] offsets;
+  delete[] starts;
+
+  printf("PLAT: Result Cardinality: %d\n", (int) result_size);
 }
 
 void local_global_worker(int* keys, int start, int end,
@@ -196,7 +392,53 @@ void local_global(int* keys, int num_tuples) {
   printf("PLAT: Result Cardinality: %d\n", result_size);
 }
 
-int* generate_data(string dist, int num_tuples, int distinct_keys) {
+/** A uniform random number in [0, 1). */
+double uniform_random() {
+  return rand() / (RAND_MAX + 1.0);
+}
+
+/**
+ * Zipf distributed ranks in [0, n), rank r with probability proportional to 1 / (r + 1)^theta,
+ * for 0 <= theta < 1 (0 is uniform), with the approximation of Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases" (SIGMOD 1994).
+ */
+void generate_zipf(int* keys, int num_tuples, int n, double theta) {
+  double zeta_n = 0;
+  for (int i=1; i<=n; i++) {
+    zeta_n += 1.0 / pow(i, theta);
+  }
+  double zeta_2 = 1.0 + 1.0 / pow(2, theta);
+  double alpha = 1.0 / (1.0 - theta);
+  double eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta_2 / zeta_n);
+  for (int i=0; i<num_tuples; i++) {
+    double u = uniform_random();
+    double uz = u * zeta_n;
+    long rank;
+    if (uz < 1.0) {
+      rank = 0;
+    } else if (uz < zeta_2) {
+      rank = 1;
+    } else {
+      rank = (long) (n * pow(eta * u - eta + 1.0, alpha));
+    }
+    keys[i] = rank < n ? rank : n - 1;
+  }
+}
+
+/**
+ * Generates num_tuples keys in [0, distinct_keys), a power of 2, with the distribution dist:
+ *
+ * uniform => Every key equally likely
+ * zipf => Zipf with exponent skew, in [0, 1)
+ * selfsimilar => A fraction 1 - skew of the tuples on a fraction skew of the keys, recursively
+ *   (0.2 is the 80-20 rule), also after Gray et al.
+ * sorted => Ascending, each key in one run of equal keys
+ * clustered => Uniform keys, each repeated in a run of CLUSTER_RUN tuples
+ *
+ * The skewed distributions scatter their frequent keys over the key range (by a multiplication
+ * with an odd constant, a permutation), rather than making them the smallest.
+ */
+int* generate_data(string dist, int num_tuples, int distinct_keys, double skew) {
   srand(0);
   int mod_mask = distinct_keys - 1;
   int* keys = new int[num_tuples];
@@ -205,46 +447,83 @@ int* generate_data(string dist, int num_tuples, int distinct_keys) {
       keys[i] = rand() & mod_mask;
     }
   } else if (dist == "zipf") {
-    // TODO:
-    // See http://www.cse.usf.edu/~christen/tools/genzipf.c .
+    generate_zipf(keys, num_tuples, distinct_keys, skew);
+    for (int i=0; i<num_tuples; i++) {
+      keys[i] = (int) ((unsigned) keys[i] * 0x9E3779B1u) & mod_mask;
+    }
+  } else if (dist == "selfsimilar") {
+    double exponent = log(skew) / log(1.0 - skew);
+    for (int i=0; i<num_tuples; i++) {
+      int rank = (int) (distinct_keys * pow(uniform_random(), exponent));
+      keys[i] = (int) ((unsigned) rank * 0x9E3779B1u) & mod_mask;
+    }
+  } else if (dist == "sorted") {
+    for (int i=0; i<num_tuples; i++) {
+      keys[i] = (int) ((i64) i * distinct_keys / num_tuples);
+    }
+  } else if (dist == "clustered") {
+    int key = 0;
+    for (int i=0; i<num_tuples; i++) {
+      if (i % CLUSTER_RUN == 0) {
+        key = rand() & mod_mask;
+      }
+      keys[i] = key;
+    }
   }
 
   return keys;
 }
 
+// The key distributions of the sweep, and their skew.
+struct Distribution { const char* name; double skew; };
+static const Distribution DISTRIBUTIONS[] = {
+  {"uniform", 0}, {"zipf", 0.5}, {"zipf", 0.99}, {"selfsimilar", 0.2},
+  {"sorted", 0}, {"clustered", 0},
+};
+#define NUM_DISTRIBUTIONS 6
+
 int main() {
-  // for (int i=14; i<15; i+=2) {
-  struct timeval before, after, diff1, diff2, diff3, diff4;
-
-  for (int i=24; i>=2; i-=2) {
-    int* keys = generate_data("uniform", NUM_TUPLES, 1 << i);
-
-    struct timeval before, after, diff1, diff2, diff3, diff4;
-
-    gettimeofday(&before, 0);
-    // single_thread_with_probe(keys, NUM_TUPLES);
-    gettimeofday(&after, 0);
-    timersub(&after, &before, &diff1);
-
-    gettimeofday(&before, 0);
-    independent_with_probe(keys, NUM_TUPLES);
-    gettimeofday(&after, 0);
-    timersub(&after, &before, &diff2);
-
-    gettimeofday(&before, 0);
-    // global_table(keys, NUM_TUPLES, 1 << (i+1));
-    gettimeofday(&after, 0);
-    timersub(&after, &before, &diff3);
-
-    gettimeofday(&before, 0);
-    plat(keys, NUM_TUPLES);
-    gettimeofday(&after, 0);
-    timersub(&after, &before, &diff4);
-
-    printf("%d %ld.%06ld %ld.%06ld %ld.%06ld %ld.%06ld\n", i,
-        (long) diff1.tv_sec, (long) diff1.tv_usec,
-        (long) diff2.tv_sec, (long) diff2.tv_usec,
-        (long) diff3.tv_sec, (long) diff3.tv_usec,
-        (long) diff4.tv_sec, (long) diff4.tv_usec);
+  for (int d=0; d<NUM_DISTRIBUTIONS; d++) {
+    const Distribution& dist = DISTRIBUTIONS[d];
+    for (int i=24; i>=2; i-=2) {
+      int* keys = generate_data(dist.name, NUM_TUPLES, 1 << i, dist.skew);
+
+      printf("%s %.2f %d", dist.name, dist.skew, i);
+      compare_tables(keys, TABLE_TUPLES);
+
+      // Each strategy splits the tuples into NUM_THREADS parts, which the threads share.
+      for (int t=0; t<NUM_THREAD_COUNTS; t++) {
+        int threads = THREAD_COUNTS[t];
+        omp_set_num_threads(threads);
+
+        struct timeval before;
+        double seconds[4];
+
+        gettimeofday(&before, 0);
+        independent_with_probe(keys, NUM_TUPLES);
+        seconds[0] = seconds_since(before);
+
+        gettimeofday(&before, 0);
+        global_table(keys, NUM_TUPLES, 1 << (i+1), false);
+        seconds[1] = seconds_since(before);
+
+        gettimeofday(&before, 0);
+        global_table(keys, NUM_TUPLES, 1 << (i+1), true);
+        seconds[2] = seconds_since(before);
+
+        gettimeofday(&before, 0);
+        plat(keys, NUM_TUPLES, PLAT_RADIX_BITS, PLAT_PASSES);
+        seconds[3] = seconds_since(before);
+
+        // The distribution, distinct keys (log 2) and threads, then the millions of tuples per
+        // second of independent, global, global with heavy hitters and PLAT.
+        printf("%s %.2f %d %d", dist.name, dist.skew, i, threads);
+        for (int s=0; s<4; s++) {
+          printf(" %.1f", NUM_TUPLES / seconds[s] / 1e6);
+        }
+        printf("\n");
+      }
+      delete[] keys;
+    }
   }
 }
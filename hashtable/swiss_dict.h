@@ -0,0 +1,178 @@
+#ifndef __NVL_SWISS_DICT_H__
+#define __NVL_SWISS_DICT_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+namespace {
+const double SWISS_LOAD_FACTOR = 0.875;
+}
+
+// Slots whose control bytes are compared with one vector instruction.
+#ifdef __AVX2__
+#define SWISS_GROUP 32
+#else
+#define SWISS_GROUP 16
+#endif
+
+// The control byte of an empty slot. A full slot's is its 7-bit hash tag, so
+// the sign bit tells the two apart.
+#define SWISS_EMPTY ((int8_t) -128)
+
+/** Mixes the key with a multiplication by 2^64 / phi, whose high half, folded into the low
+ * one, depends on all bits of a 32-bit key. Strided or clustered keys thus spread over the table.
+ */
+inline uint64_t swiss_hash(uint64_t key) {
+  uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 32);
+}
+
+/**
+ * Append-only dictionary using open addressing, after Google's Swiss tables, with the API of Dict:
+ * put adds value to the value of an existing key.
+ *
+ * The slots are split into groups of SWISS_GROUP. Besides the slot array, which holds only keys and
+ * values (8 bytes for a SwissDict<int, int>, where a Dict entry is padded to 12), each slot has a
+ * control byte: SWISS_EMPTY, or 7 bits of its key's hash. A lookup loads the control bytes of a
+ * group into a vector register and compares all of them to the tag with one SSE2 (16 slots) or AVX2
+ * (32 slots) instruction, so only the keys whose tags match, on average far fewer than one per
+ * mismatching group, are compared. Groups are probed quadratically, and a group with an empty slot
+ * ends the probe. The table stays below SWISS_LOAD_FACTOR full.
+ *
+ * Unlike Dict, a SwissDict owns its arrays and cannot be copied.
+ */
+template<typename K, typename V>
+class SwissDict {
+  struct Slot { K key; V value; };
+
+  int8_t *_ctrl;
+  Slot *_slots;
+  size_t _size;       // Number of elements we've really filled
+  size_t _capacity;   // Total number of slots, a power-of-2 multiple of SWISS_GROUP
+
+public:
+  SwissDict(): _ctrl(0), _slots(0), _size(0), _capacity(0) {}
+
+  ~SwissDict() {
+    free(_ctrl);
+    free(_slots);
+  }
+
+  /** Get a pointer to the value for a given key, or null if it is missing */
+  V* get(const K& key) {
+    if (!_ctrl) {
+      return 0;
+    }
+    uint64_t h = swiss_hash((uint64_t) key);
+    int8_t tag = h & 0x7F;
+    size_t group_mask = _capacity / SWISS_GROUP - 1;
+    size_t group = (h >> 7) & group_mask;
+    for (size_t step = 1; ; step++) {
+      const int8_t *ctrl = _ctrl + group * SWISS_GROUP;
+      for (uint32_t m = match(ctrl, tag); m != 0; m &= m - 1) {
+        Slot *slot = &_slots[group * SWISS_GROUP + __builtin_ctz(m)];
+        if (slot->key == key) {
+          return &slot->value;
+        }
+      }
+      if (match(ctrl, SWISS_EMPTY) != 0) {
+        return 0;
+      }
+      group = (group + step) & group_mask;
+    }
+  }
+
+  /** Insert a value with the given key, adding it to any previous one */
+  void put(const K& key, const V& value) {
+    if (_size + 1 > SWISS_LOAD_FACTOR * _capacity) {
+      growAndRehash();
+    }
+    if (putInto(_ctrl, _slots, _capacity, key, value)) {
+      _size += 1;
+    }
+  }
+
+  size_t size() const {
+    return _size;
+  }
+
+  /** Iterate over other dict and insert its elements into current dict **/
+  void combine(const SwissDict<K, V>& other) {
+    for (size_t i = 0; i < other._capacity; i++) {
+      if (other._ctrl[i] != SWISS_EMPTY) {
+        put(other._slots[i].key, other._slots[i].value);
+      }
+    }
+  }
+
+private:
+  SwissDict(const SwissDict<K, V>&);
+  SwissDict<K, V>& operator = (const SwissDict<K, V>&);
+
+  /** Returns a bit per slot of the group at ctrl whose control byte is c. */
+  static inline uint32_t match(const int8_t *ctrl, int8_t c) {
+#ifdef __AVX2__
+    __m256i group = _mm256_load_si256((const __m256i*) ctrl);
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8(c)));
+#else
+    __m128i group = _mm_load_si128((const __m128i*) ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#endif
+  }
+
+  /**
+   * Double the size of the table and re-hash values into new positions.
+   */
+  void growAndRehash() {
+    size_t newCapacity = (_capacity == 0) ? SWISS_GROUP : _capacity * 2;
+    int8_t *newCtrl = (int8_t*) aligned_alloc(SWISS_GROUP, newCapacity);
+    Slot *newSlots = (Slot*) malloc(newCapacity * sizeof(Slot));
+    memset(newCtrl, SWISS_EMPTY, newCapacity);
+    for (size_t i = 0; i < _capacity; i++) {
+      if (_ctrl[i] != SWISS_EMPTY) {
+        putInto(newCtrl, newSlots, newCapacity, _slots[i].key, _slots[i].value);
+      }
+    }
+    free(_ctrl);
+    free(_slots);
+    _ctrl = newCtrl;
+    _slots = newSlots;
+    _capacity = newCapacity;
+  }
+
+  /**
+   * Add an entry into a hash table without resising it (it's guaranteed that the entry will fit).
+   * Returns true if we added a new key or false if the key already existed.
+   */
+  static bool putInto(int8_t *ctrls, Slot *slots, size_t capacity, const K& key, const V& value) {
+    uint64_t h = swiss_hash((uint64_t) key);
+    int8_t tag = h & 0x7F;
+    size_t group_mask = capacity / SWISS_GROUP - 1;
+    size_t group = (h >> 7) & group_mask;
+    for (size_t step = 1; ; step++) {
+      int8_t *ctrl = ctrls + group * SWISS_GROUP;
+      for (uint32_t m = match(ctrl, tag); m != 0; m &= m - 1) {
+        Slot *slot = &slots[group * SWISS_GROUP + __builtin_ctz(m)];
+        if (slot->key == key) {
+          slot->value += value;
+          return false;
+        }
+      }
+      // Nothing is ever removed, so the key would be before the first empty
+      // slot: it is new.
+      uint32_t empty = match(ctrl, SWISS_EMPTY);
+      if (empty != 0) {
+        size_t pos = group * SWISS_GROUP + __builtin_ctz(empty);
+        ctrls[pos] = tag;
+        slots[pos].key = key;
+        slots[pos].value = value;
+        return true;
+      }
+      group = (group + step) & group_mask;
+    }
+  }
+};
+
+#endif // __NVL_SWISS_DICT_H__